@@ -0,0 +1,146 @@
+// Counts the allocations made while paths are read, to check that commands
+// are expanded into storage sized up front rather than copied one by one.
+// Built and run by test.sh.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+
+static size_t allocations = 0;
+
+void *operator new(size_t size)
+{
+  allocations++;
+  void *p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+#define SVG_NO_MAIN
+#include "svg.cc"
+
+/// Path data of two subpaths, each with commands pairs of l and c
+static std::string PathData(int commands)
+{
+  std::string d;
+  for (int s = 0; s < 2; s++)
+  {
+    d += "M 0 0";
+    for (int i = 0; i < commands; i++)
+      d += " L 1 2 3 4 C 1 2 3 4 5 6 7 8 9 10 11 12";
+    d += " z ";
+  }
+  return d;
+}
+
+/// Path data of commands small arcs in a row
+static std::string ArcData(int commands)
+{
+  std::string d = "M 0 0";
+  for (int i = 0; i < commands; i++)
+    d += " a 1 1 0 0 1 .5 0";
+  return d;
+}
+
+/// Writes an svg file of paths with the given numbers of commands, of
+/// arcs if arcs is set
+static bool WriteSvg(const char *filename, const std::vector<int> &commands, bool arcs = false)
+{
+  std::string svg = "<svg>";
+  for (int count : commands)
+    svg += "<path d=\"" + (arcs ? ArcData(count) : PathData(count)) + "\"/>";
+  svg += "</svg>";
+  FILE *f = fopen(filename, "w");
+  if (!f)
+    return false;
+  bool written = fwrite(svg.data(), 1, svg.size(), f) == svg.size();
+  return fclose(f) == 0 && written;
+}
+
+/// Allocations for reading filename into a DOM and its paths
+static size_t ParseAllocations(const char *filename, bool keep)
+{
+  size_t before = allocations;
+  SvgReader reader;
+  reader.KeepCommands(keep);
+  std::vector<Path> paths;
+  reader.Parse(filename, paths);
+  return allocations - before;
+}
+
+static int failures = 0;
+
+static void Check(bool ok, bool keep, const char *what, size_t count)
+{
+  if (!ok)
+  {
+    printf("FAIL %s%s: %zu allocations\n", what, keep ? ", commands kept" : "", count);
+    failures++;
+  }
+}
+
+int main()
+{
+  const char *small = "/tmp/alloc_test_small.svg";
+  const char *large = "/tmp/alloc_test_large.svg";
+  const char *streamed = "/tmp/alloc_test_streamed.svg";
+  const char *arcs = "/tmp/alloc_test_arcs.svg";
+  if (!WriteSvg(small, std::vector<int>(1, 50)) ||
+      !WriteSvg(large, std::vector<int>(1, 5000)) ||
+      !WriteSvg(streamed, std::vector<int>{50, 5000, 5000}) ||
+      !WriteSvg(arcs, std::vector<int>{100, 20000}, true))
+  {
+    perror("alloc_test");
+    return 1;
+  }
+
+  // with the commands expanded, and flattened in a single pass
+  for (int keep = 0; keep < 2; keep++)
+  {
+    // the DOM, which is the default: the same document with 100 times the
+    // commands only grows what is sized by doubling; anything per command
+    // would be thousands
+    size_t smallCount = ParseAllocations(small, keep != 0);
+    size_t largeCount = ParseAllocations(large, keep != 0);
+    Check(largeCount < smallCount + 100, keep != 0, "DOM, 10000 commands instead of 100", largeCount - smallCount);
+
+    // streaming, with one reader and one Path reused from path to path
+    SvgReader reader;
+    reader.KeepCommands(keep != 0);
+    std::vector<size_t> counts;
+    size_t last = allocations;
+    reader.ParseStreaming(streamed, [&](const Path &)
+    {
+      counts.push_back(allocations - last);
+      last = allocations;
+    });
+    Check(counts.size() == 3 && counts[1] < 100, keep != 0, "streaming, 10000 commands after 100", counts.size() == 3 ? counts[1] : 0);
+    // and a path of the same size again needs nothing new at all
+    Check(counts.size() == 3 && counts[2] == 0, keep != 0, "streaming, the same path again", counts.size() == 3 ? counts[2] : 0);
+
+    // arcs add their points to the path one by one, which has to grow it
+    // geometrically and not by the arc, or many arcs take quadratic time
+    counts.clear();
+    last = allocations;
+    reader.ParseStreaming(arcs, [&](const Path &)
+    {
+      counts.push_back(allocations - last);
+      last = allocations;
+    });
+    Check(counts.size() == 2 && counts[1] < 100, keep != 0, "streaming, 20000 arcs after 100", counts.size() == 2 ? counts[1] : 0);
+  }
+
+  unlink(small);
+  unlink(large);
+  unlink(streamed);
+  unlink(arcs);
+  if (failures == 0)
+    printf("alloc_test: PASS\n");
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,348 @@
+// Times the hot loops of svg.cc and tinyxmlparser.cpp against the
+// straightforward code they replaced, on synthetic curves and on the text
+// of svg files, and prints the best of several runs of each. Built and run
+// by bench.sh; the numbers depend on the machine, so only their ratios
+// mean anything.
+
+#include <chrono>
+#include <functional>
+
+#define SVG_NO_MAIN
+#include "svg.cc"
+// for its scanners, which are static
+#include "tinyxmlparser.cpp"
+
+/// Best time in seconds of runs calls of f
+static double Best(int runs, const std::function<void()> &f)
+{
+  double best = 1e30;
+  for (int r = 0; r < runs; r++)
+  {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    best = std::min(best, elapsed.count());
+  }
+  return best;
+}
+
+/// Keeps the compiler from dropping work whose result is otherwise unused
+static volatile double sink;
+
+// The cubic kernels, on a batch of curves of mixed step counts as the
+// resolution of a drawing gives them. A batch is the curves of one path, so
+// its points are usually in cache; the largest paths are not.
+static void BenchCubics(size_t curves)
+{
+  CubicBatch batch;
+  std::vector<Point> controls;
+  size_t total = 0;
+  srand(1);
+  for (size_t k = 0; k < curves; k++)
+  {
+    Point p[4];
+    for (int j = 0; j < 4; j++)
+    {
+      p[j].x = rand() % 1000;
+      p[j].y = rand() % 1000;
+      controls.push_back(p[j]);
+    }
+    unsigned int steps = 8 + rand() % 120;
+    batch.Add(p[0], p[1], p[2], p[3], steps, total);
+    total += steps;
+  }
+  std::vector<Point> points(total);
+
+  printf("cubics, %zu curves, %zu points, ns per point:\n", curves, total);
+  auto report = [&](const char *name, double seconds)
+  {
+    printf("  %-28s %6.2f\n", name, seconds * 1e9 / total);
+  };
+
+  // what flattening did before the batch: the Bernstein form at every t
+  report("bezierInterpolate", Best(10, [&]
+  {
+    for (size_t k = 0; k < curves; k++)
+    {
+      const Point *p = &controls[4 * k];
+      unsigned int steps = batch.stepCounts[k];
+      Point *out = &points[batch.offsets[k]];
+      for (unsigned int i = 1; i <= steps; i++)
+        out[i - 1] = bezierInterpolate((double)i / steps, p[0], p[1], p[2], p[3]);
+    }
+  }));
+  // the batch evaluated by Horner's rule at every t
+  report("Horner", Best(10, [&]
+  {
+    for (size_t k = 0; k < curves; k++)
+    {
+      unsigned int steps = batch.stepCounts[k];
+      Point *out = &points[batch.offsets[k]];
+      for (unsigned int i = 1; i <= steps; i++)
+      {
+        double t = (double)i / steps;
+        out[i - 1].x = ((batch.ax[k] * t + batch.bx[k]) * t + batch.cx[k]) * t + batch.dx[k];
+        out[i - 1].y = ((batch.ay[k] * t + batch.by[k]) * t + batch.cy[k]) * t + batch.dy[k];
+      }
+    }
+  }));
+  report("forward differences, scalar", Best(10, [&] { EvaluateCubicsScalar(batch, points); }));
+#ifdef SVG_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    report("forward differences, SSE2", Best(10, [&] { EvaluateCubicsSSE2(batch, points); }));
+#endif
+  sink = points[total / 2].x;
+}
+
+/// Appends the d attribute of every element under node to data
+static void CollectPathData(const TiXmlNode *node, std::vector<std::string> &data)
+{
+  for (const TiXmlElement *e = node->FirstChildElement(); e; e = e->NextSiblingElement())
+  {
+    if (const char *d = e->Attribute("d"))
+      data.push_back(d);
+    CollectPathData(e, data);
+  }
+}
+
+// The coordinates of the given path data, read by ReadDouble and by what
+// the tokenizer used before it: atof on a copy of each number, and strtod
+static void BenchNumbers(const std::vector<std::string> &data)
+{
+  std::vector<const char *> starts;
+  std::vector<size_t> lengths;
+  for (const std::string &d : data)
+  {
+    const char *p = d.c_str();
+    while (*p)
+    {
+      double number;
+      const char *end = TiXmlBase::ReadDouble(p, &number);
+      if (!end)
+      {
+        p++;
+        continue;
+      }
+      starts.push_back(p);
+      lengths.push_back(end - p);
+      p = end;
+    }
+  }
+  const int PASSES = 20;
+  size_t count = starts.size() * PASSES;
+  printf("numbers, %zu from the path data, millions per second:\n", starts.size());
+  auto report = [&](const char *name, double seconds)
+  {
+    printf("  %-28s %6.1f\n", name, count / seconds / 1e6);
+  };
+
+  report("atof on a copy", Best(5, [&]
+  {
+    double total = 0;
+    for (int pass = 0; pass < PASSES; pass++)
+      for (size_t i = 0; i < starts.size(); i++)
+        total += atof(std::string(starts[i], lengths[i]).c_str());
+    sink = total;
+  }));
+  report("strtod", Best(5, [&]
+  {
+    double total = 0;
+    for (int pass = 0; pass < PASSES; pass++)
+      for (size_t i = 0; i < starts.size(); i++)
+        total += strtod(starts[i], 0);
+    sink = total;
+  }));
+  report("ReadDouble", Best(5, [&]
+  {
+    double total = 0;
+    for (int pass = 0; pass < PASSES; pass++)
+      for (size_t i = 0; i < starts.size(); i++)
+      {
+        double number;
+        TiXmlBase::ReadDouble(starts[i], &number);
+        total += number;
+      }
+    sink = total;
+  }));
+}
+
+/// A command as it was stored before CommandList: with its own numbers
+struct CopiedCommand
+{
+  char type;
+  std::vector<double> numbers;
+};
+
+/// The split() path data was tokenized with before PathTokenizer
+static std::vector<std::string> &Split(const std::string &s, char delim, std::vector<std::string> &elems)
+{
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, delim))
+    elems.push_back(item);
+  return elems;
+}
+
+// Path data split into commands and their numbers, by PathTokenizer and by
+// the lowercase, split on spaces, split on commas and atof it replaced
+static void BenchTokenizer(const std::vector<std::string> &data)
+{
+  size_t bytes = 0;
+  for (const std::string &d : data)
+    bytes += d.size();
+  const int PASSES = 20;
+  printf("path data, %zu bytes, MB per second:\n", bytes);
+  auto report = [&](const char *name, double seconds)
+  {
+    printf("  %-28s %6.1f\n", name, bytes * PASSES / seconds / 1e6);
+  };
+
+  report("split and atof", Best(5, [&]
+  {
+    size_t numbers = 0;
+    for (int pass = 0; pass < PASSES; pass++)
+      for (const std::string &d : data)
+      {
+        std::vector<CopiedCommand> commands;
+        std::vector<double> values;
+        char type = 'x';
+        std::vector<std::string> tokens;
+        for (const std::string &token : Split(lowercase(d), ' ', tokens))
+        {
+          if (token.empty())
+            continue;
+          if (PathCommandIndex(token[0]) < 0)
+          {
+            std::vector<std::string> numberStrs;
+            for (const std::string &numberStr : Split(token, ',', numberStrs))
+              values.push_back(atof(numberStr.c_str()));
+            continue;
+          }
+          if (type != 'x')
+            commands.push_back(CopiedCommand{type, values});
+          numbers += values.size();
+          type = token[0];
+          values.clear();
+        }
+        if (type != 'x')
+          commands.push_back(CopiedCommand{type, values});
+        numbers += values.size();
+      }
+    sink = numbers;
+  }));
+  report("PathTokenizer", Best(5, [&]
+  {
+    size_t numbers = 0;
+    std::vector<double> values;
+    for (int pass = 0; pass < PASSES; pass++)
+      for (const std::string &d : data)
+      {
+        PathTokenizer tokenizer(d.c_str());
+        char type;
+        while (tokenizer.NextCommand(type))
+        {
+          values.clear();
+          double number;
+          while (tokenizer.NextNumber(number))
+            values.push_back(number);
+          numbers += values.size();
+        }
+      }
+    sink = numbers;
+  }));
+}
+
+/// Times scan with every scanner kernel the cpu has, from each of starts
+static void ReportScanner(const char *name, const std::vector<const char *> &starts,
+                          const std::function<const char *(const TiXmlScanners &, const char *)> &scan)
+{
+  static const TiXmlScanners scalar = { SkipSpacesScalar, SkipNameCharsScalar, FindTextStopScalar };
+  std::vector<std::pair<const char *, const TiXmlScanners *>> kernels;
+  kernels.push_back(std::make_pair("scalar", &scalar));
+#ifdef TIXML_X86_SCANNERS
+  static const TiXmlScanners sse2 = { SkipSpacesSSE2, SkipNameCharsSSE2, FindTextStopSSE2 };
+  static const TiXmlScanners avx2 = { SkipSpacesAVX2, SkipNameCharsAVX2, FindTextStopAVX2 };
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    kernels.push_back(std::make_pair("SSE2", &sse2));
+  if (__builtin_cpu_supports("avx2"))
+    kernels.push_back(std::make_pair("AVX2", &avx2));
+#endif
+  const int PASSES = 20;
+  size_t bytes = 0;
+  for (const char *p : starts)
+    bytes += scan(scalar, p) - p;
+  printf("  %s, %zu runs of %.1f bytes on average:\n", name, starts.size(), (double)bytes / starts.size());
+  for (const auto &kernel : kernels)
+  {
+    double seconds = Best(5, [&]
+    {
+      size_t total = 0;
+      for (int pass = 0; pass < PASSES; pass++)
+        for (const char *p : starts)
+          total += scan(*kernel.second, p) - p;
+      sink = total;
+    });
+    printf("    %-26s %6.2f\n", kernel.first, seconds * 1e9 / (starts.size() * PASSES));
+  }
+}
+
+// The scanners of tinyxmlparser.cpp on the text of the svg files, each
+// from where the parser would call it: the indentation after a line
+// break, the name after a '<' or a space, and an attribute value
+static void BenchScanners(const std::string &text)
+{
+  std::vector<const char *> spaces, names, values;
+  for (size_t i = 1; i < text.size(); i++)
+  {
+    const char *p = &text[i];
+    char before = text[i - 1];
+    if (before == '\n')
+      spaces.push_back(p);
+    if ((before == '<' || before == ' ') && isalpha((unsigned char)*p))
+      names.push_back(p + 1);
+    if (before == '"' && i > 1 && text[i - 2] == '=')
+      values.push_back(p);
+  }
+  printf("scanners, ns per call:\n");
+  ReportScanner("whitespace", spaces, [](const TiXmlScanners &s, const char *p) { return s.skipSpaces(p); });
+  ReportScanner("names", names, [](const TiXmlScanners &s, const char *p) { return s.skipNameChars(p); });
+  ReportScanner("attribute values", values, [](const TiXmlScanners &s, const char *p) { return s.findTextStop(p, '"', '<'); });
+}
+
+// Usage: bench [file.svg...]; the svg files default to the examples
+int main(int argc, char *argv[])
+{
+  std::vector<std::string> files(argv + 1, argv + argc);
+  if (files.empty())
+    files = {"a.svg", "paths.svg"};
+  std::vector<std::string> data;
+  std::string text;
+  for (const std::string &file : files)
+  {
+    FILE *f = fopen(file.c_str(), "rb");
+    if (f)
+    {
+      char buffer[4096];
+      size_t read;
+      while ((read = fread(buffer, 1, sizeof(buffer), f)) > 0)
+        text.append(buffer, read);
+      fclose(f);
+    }
+    TiXmlDocument doc(file.c_str());
+    if (!doc.LoadFile())
+    {
+      fprintf(stderr, "bench: can't read %s: %s\n", file.c_str(), doc.ErrorDesc());
+      return 1;
+    }
+    CollectPathData(&doc, data);
+  }
+
+  BenchCubics(1000);
+  BenchCubics(20000);
+  BenchNumbers(data);
+  BenchTokenizer(data);
+  BenchScanners(text);
+  return 0;
+}
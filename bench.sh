@@ -0,0 +1 @@
+g++ -std=c++11 -O2 -pthread bench.cc tinystr.cpp tinyxml.cpp tinyxmlerror.cpp -o bench && ./bench
@@ -1 +1 @@
-g++ -std=c++11 svg.cc tinystr.cpp tinyxml.cpp tinyxmlerror.cpp tinyxmlparser.cpp -o svg
+g++ -std=c++11 -pthread svg.cc tinystr.cpp tinyxml.cpp tinyxmlerror.cpp tinyxmlparser.cpp -o svg
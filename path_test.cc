@@ -0,0 +1,103 @@
+// Checks the path commands that are easy to get subtly wrong: arc flags
+// written without separators, s and t after commands they have no control
+// point to reflect from, and the two ways a path is flattened giving the
+// same points. Built and run by test.sh.
+
+#include <stdio.h>
+
+#define SVG_NO_MAIN
+#include "svg.cc"
+
+/// The points the path data d flattens to, with or without the commands kept
+static std::vector<Point> Flatten(const char *d, bool keep, SvgReader::Flattening flattening)
+{
+  const char *filename = "/tmp/path_test.svg";
+  FILE *f = fopen(filename, "w");
+  if (!f)
+  {
+    perror("path_test");
+    exit(1);
+  }
+  fprintf(f, "<svg><path d=\"%s\"/></svg>", d);
+  fclose(f);
+
+  SvgReader reader(0.1, flattening);
+  reader.KeepCommands(keep);
+  std::vector<Path> paths;
+  reader.Parse(filename, paths);
+  unlink(filename);
+  return paths.empty() ? std::vector<Point>() : paths[0].points;
+}
+
+static bool Same(const std::vector<Point> &a, const std::vector<Point> &b)
+{
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); i++)
+    if (a[i].x != b[i].x || a[i].y != b[i].y)
+      return false;
+  return true;
+}
+
+static int failures = 0;
+
+/// Checks that d and expected flatten to the same points, whichever way
+static void CheckSame(const char *what, const char *d, const char *expected)
+{
+  for (int keep = 0; keep < 2; keep++)
+    for (SvgReader::Flattening flattening : {SvgReader::ADAPTIVE, SvgReader::UNIFORM})
+    {
+      std::vector<Point> points = Flatten(d, keep != 0, flattening);
+      if (points.empty() || !Same(points, Flatten(expected, keep != 0, flattening)))
+      {
+        printf("FAIL %s%s%s: \"%s\" is not \"%s\"\n", what, keep ? ", commands kept" : "",
+               flattening == SvgReader::UNIFORM ? ", uniform" : "", d, expected);
+        failures++;
+      }
+    }
+}
+
+/// Checks that d flattens to the same points with the commands kept as
+/// without, which take different routes through the reader
+static void CheckRoutes(const char *what, const char *d)
+{
+  for (SvgReader::Flattening flattening : {SvgReader::ADAPTIVE, SvgReader::UNIFORM})
+  {
+    std::vector<Point> fused = Flatten(d, false, flattening);
+    if (fused.empty() || !Same(fused, Flatten(d, true, flattening)))
+    {
+      printf("FAIL %s%s: commands kept and not differ\n", what,
+             flattening == SvgReader::UNIFORM ? ", uniform" : "");
+      failures++;
+    }
+  }
+}
+
+int main()
+{
+  // a flag is a single digit, so nothing needs to separate it
+  CheckSame("compact arc flags", "M 0 0 a1 1 0 0110 10", "M 0 0 a 1 1 0 0 1 10 10");
+  CheckSame("compact arc flags, repeated", "M 0 0 A5 5 0 1020 0 5 5 0 01-20 0",
+            "M 0 0 A 5 5 0 1 0 20 0 A 5 5 0 0 1 -20 0");
+
+  // s and t reflect the control point of the curve before them only if it
+  // is of their own kind; otherwise it is the current point
+  CheckSame("s after l", "M 0 0 L 10 0 S 20 10 30 0", "M 0 0 L 10 0 C 10 0 20 10 30 0");
+  CheckSame("s after q", "M 0 0 Q 5 10 10 0 S 20 10 30 0", "M 0 0 Q 5 10 10 0 C 10 0 20 10 30 0");
+  CheckSame("s after c", "M 0 0 C 0 10 10 10 10 0 s 10 -10 20 0", "M 0 0 C 0 10 10 10 10 0 C 10 -10 20 -10 30 0");
+  CheckSame("t after l", "M 0 0 L 10 0 T 30 10", "M 0 0 L 10 0 Q 10 0 30 10");
+  CheckSame("t after c", "M 0 0 C 0 10 10 10 10 0 T 30 10", "M 0 0 C 0 10 10 10 10 0 Q 10 0 30 10");
+  CheckSame("t after q", "M 0 0 Q 5 10 10 0 t 10 0", "M 0 0 Q 5 10 10 0 Q 15 -10 20 0");
+  CheckSame("s after z", "M 0 0 C 0 10 10 10 10 0 Z S 20 10 30 0", "M 0 0 C 0 10 10 10 10 0 Z C 0 0 20 10 30 0");
+
+  CheckRoutes("every command",
+              "M 10 10 L 20 20 H 30 V 40 l 5 5 h -5 v -5 "
+              "C 0 0 50 50 60 10 S 70 0 80 10 c 5 5 10 0 15 0 s 5 -5 10 0 "
+              "Q 90 0 100 10 T 110 10 q 5 5 10 0 t 10 0 "
+              "A 10 5 30 0 1 140 20 a 5 10 0 1 0 10 10 Z "
+              "m 5 5 l 10 0 z M 200 200 1e1 1e1 c-1-1-2-2-3-3");
+
+  if (failures == 0)
+    printf("path_test: PASS\n");
+  return failures == 0 ? 0 : 1;
+}
@@ -1,12 +1,31 @@
 #include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
 #include <exception>
 #include <sstream>
 #include <string>
 #include <algorithm>
 #include <vector>
 #include <iostream>
+#include <functional>
+#include <memory>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include "tinyxml.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// an SSE2 curve kernel, picked at run time
+#define SVG_X86_KERNELS
+#include <immintrin.h>
+#endif
+
 class SvgError: public std::runtime_error
 { public: SvgError(const std::string& what_arg): std::runtime_error(what_arg){};};
 
@@ -18,12 +37,26 @@ struct Point
     double y;
 };
 
+/// A run of elements inside one of the arrays of a Path
+template <typename T>
+struct Span
+{
+   const T *first;
+   const T *last;
+
+   const T *begin() const { return first; }
+   const T *end() const { return last; }
+   size_t size() const { return last - first; }
+   const T &operator[](size_t i) const { return first[i]; }
+};
+
+/// A command of a CommandList and its numbers
 struct Command
 {
    char type;
-   std::vector<double> numbers;
+   Span<double> numbers;
   
-   std::string tostr() 
+   std::string tostr() const
    {
      std::ostringstream os;
      os << type << "[";
@@ -36,43 +69,496 @@ struct Command
    }   
 };
 
+/// Commands stored back to back: one letter per command in types and the
+/// numbers of all of them in numbers, so a whole path is three allocations
+struct CommandList
+{
+   std::vector<char> types;
+   std::vector<double> numbers;
+   /// where the numbers of each command start
+   std::vector<size_t> offsets;
+
+   void Add(char type)
+   {
+     types.push_back(type);
+     offsets.push_back(numbers.size());
+   }
+
+   /// Adds a number to the last command
+   void AddNumber(double number) { numbers.push_back(number); }
+
+   size_t size() const { return types.size(); }
+
+   Command operator[](size_t i) const
+   {
+     Command cmd;
+     cmd.type = types[i];
+     cmd.numbers.first = numbers.data() + offsets[i];
+     cmd.numbers.last = numbers.data() + (i + 1 < offsets.size() ? offsets[i + 1] : numbers.size());
+     return cmd;
+   }
+
+   void clear()
+   {
+     types.clear();
+     numbers.clear();
+     offsets.clear();
+   }
+};
+
+/// A command of SVG path data, by its lower case letter: how many numbers
+/// each repetition of it takes, and which of them are flags, a single 0 or
+/// 1 that needs no separator after it
+struct PathCommand
+{
+   char letter;
+   unsigned char numbers;
+   /// bit i is set if number i is a flag
+   unsigned char flags;
+};
+
+static constexpr PathCommand PATH_COMMANDS[] =
+{
+  { 'm', 2, 0 }, { 'z', 0, 0 }, { 'l', 2, 0 }, { 'h', 1, 0 }, { 'v', 1, 0 },
+  { 'c', 6, 0 }, { 's', 4, 0 }, { 'q', 4, 0 }, { 't', 2, 0 },
+  // rx ry x-axis-rotation large-arc-flag sweep-flag x y
+  { 'a', 7, (1 << 3) | (1 << 4) }
+};
+
+static constexpr int PATH_COMMAND_COUNT = sizeof(PATH_COMMANDS) / sizeof(PATH_COMMANDS[0]);
+
+/// Where letter, in either case, is in PATH_COMMANDS, or -1 if it is not a
+/// command
+static constexpr int PathCommandIndex(char letter, int i = 0)
+{
+  return i == PATH_COMMAND_COUNT ? -1 :
+         PATH_COMMANDS[i].letter == (letter >= 'A' && letter <= 'Z' ? letter - 'A' + 'a' : letter) ? i :
+         PathCommandIndex(letter, i + 1);
+}
+
+/// The numbers each repetition of a command takes
+static constexpr unsigned int NumberCount(char type)
+{
+  return PathCommandIndex(type) < 0 ? 0 : PATH_COMMANDS[PathCommandIndex(type)].numbers;
+}
+
+/// Whether number i of each repetition of a command is a flag
+static constexpr bool IsFlag(char type, size_t i)
+{
+  return PathCommandIndex(type) >= 0 && i < 8 && ((PATH_COMMANDS[PathCommandIndex(type)].flags >> i) & 1);
+}
+
+static constexpr unsigned int MostNumbers(int i = 0)
+{
+  return i == PATH_COMMAND_COUNT ? 0 :
+         PATH_COMMANDS[i].numbers > MostNumbers(i + 1) ? PATH_COMMANDS[i].numbers : MostNumbers(i + 1);
+}
+
+/// A command once its numbers are grouped: the letter and exactly as many
+/// numbers as it takes, held inline so that the commands of a path are a
+/// single array that copies like plain memory
+struct Segment
+{
+   /// room for the command taking the most, the elliptical arc
+   enum { MAX_NUMBERS = 7 };
+
+   char type;
+   double numbers[MAX_NUMBERS];
+
+   static_assert(MostNumbers() <= MAX_NUMBERS, "a command takes more numbers than a Segment holds");
+
+   std::string tostr() const
+   {
+     std::ostringstream os;
+     os << type << "[";
+     for (unsigned int i = 0; i < NumberCount(type); i++)
+     {
+       os << numbers[i] << ", ";
+     }
+     os << "]";
+     return os.str();
+   }
+};
+
 struct Path
 {
    std::string id;
    std::string style;
 
-   std::vector< std::vector<Command> > subpaths;   
+   /// the commands of every subpath, back to back
+   std::vector<Segment> commands;
+   /// where each subpath starts in commands
+   std::vector<size_t> subpaths;
+
+   /// the points of every polyline, back to back
+   std::vector<Point> points;
+   /// where each polyline starts in points
+   std::vector<size_t> polylines;
+
+   size_t PolylineCount() const { return polylines.size(); }
+
+   Span<Point> Polyline(size_t i) const
+   {
+     Span<Point> polyline;
+     polyline.first = points.data() + polylines[i];
+     polyline.last = points.data() + (i + 1 < polylines.size() ? polylines[i + 1] : points.size());
+     return polyline;
+   }
+
+   /// Empties the path but keeps its memory for the next one
+   void clear()
+   {
+     id.clear();
+     style.clear();
+     commands.clear();
+     subpaths.clear();
+     points.clear();
+     polylines.clear();
+   }
+};
+
+
+/// Reads the commands and numbers of a path's d attribute in place, one at
+/// a time, without copying or splitting the string. Separators are optional
+/// wherever the grammar allows it: "M10-5.5.5" is M 10 -5.5 0.5, and
+/// "a1 1 0 0110 10" is a 1 1 0 0 1 10 10
+class PathTokenizer
+{
+  public: PathTokenizer(const char *_data): data(_data), cursor(_data) {}
+
+  /// Moves to the next command letter. Returns false at the end of the data
+  public: bool NextCommand(char &cmd)
+  {
+    this->SkipSeparators();
+    if (*cursor == '\0')
+      return false;
+    if (PathCommandIndex(*cursor) < 0)
+    {
+      std::ostringstream os;
+      os << "Unexpected '" << *cursor << "' at offset " << cursor - data << " in path data";
+      SvgError x(os.str());
+      throw x;
+    }
+    cmd = *cursor++;
+    return true;
+  }
+
+  /// Reads the next number of the current command. Returns false, without
+  /// moving, if the next token is not a number
+  public: bool NextNumber(double &number)
+  {
+    this->SkipSeparators();
+    // correctly rounded, and no copy of the text is needed
+    const char *end = TiXmlBase::ReadDouble(cursor, &number);
+    if (!end)
+      return false;
+    // "1e400" is a number, but not one a curve can be drawn through
+    if (!std::isfinite(number))
+    {
+      std::ostringstream os;
+      os << "Number out of range at offset " << cursor - data << " in path data";
+      SvgError x(os.str());
+      throw x;
+    }
+    cursor = end;
+    return true;
+  }
+
+  /// Reads number i of a repetition of command type: a flag or a number
+  public: bool NextArgument(char type, size_t i, double &number)
+  {
+    if (!IsFlag(type, i))
+      return this->NextNumber(number);
+    this->SkipSeparators();
+    if (*cursor != '0' && *cursor != '1')
+      return false;
+    number = *cursor++ - '0';
+    return true;
+  }
+
+  private: void SkipSeparators()
+  {
+    while (*cursor == ' ' || *cursor == ',' || *cursor == '\t' ||
+           *cursor == '\n' || *cursor == '\r' || *cursor == '\f')
+      cursor++;
+  }
+
+  private: const char *data;
+  private: const char *cursor;
+};
+
+
+
+/// Collects text in one large buffer that is reused for the whole run and
+/// hands it to a file descriptor with a single write(2) each time it fills
+/// up. Numbers are written as the shortest text that reads back exactly.
+class OutputBuffer
+{
+  public: OutputBuffer(int _fd, size_t capacity = 1 << 20)
+          : fd(_fd), buffer(capacity), used(0) {}
+
+  /// Keeps the text in memory, growing as needed, until it is copied to
+  /// another buffer with Write
+  public: OutputBuffer()
+          : fd(-1), buffer(1 << 16), used(0) {}
+
+  /// Writes out what is left, so text printed before an error still
+  /// reaches the file descriptor while the error unwinds
+  public: ~OutputBuffer()
+  {
+    try
+    {
+      this->Flush();
+    }
+    catch (const std::exception &)
+    {
+      // nowhere left to report it
+    }
+  }
+
+  public: OutputBuffer &operator<<(const char *text)
+  {
+    return this->Write(text, strlen(text));
+  }
+
+  public: OutputBuffer &operator<<(const std::string &text)
+  {
+    return this->Write(text.data(), text.size());
+  }
+
+  public: OutputBuffer &operator<<(char c)
+  {
+    this->MakeRoom(1);
+    buffer[used++] = c;
+    return *this;
+  }
+
+  public: OutputBuffer &operator<<(double number)
+  {
+    this->MakeRoom(TIXML_DOUBLE_LENGTH);
+    used = TiXmlBase::WriteDouble(number, &buffer[used]) - &buffer[0];
+    return *this;
+  }
+
+  public: OutputBuffer &Write(const char *text, size_t length)
+  {
+    // too big to be worth copying
+    if (fd >= 0 && length >= buffer.size())
+    {
+      this->Flush();
+      this->WriteAll(text, length);
+      return *this;
+    }
+    this->MakeRoom(length);
+    memcpy(&buffer[used], text, length);
+    used += length;
+    return *this;
+  }
+
+  /// Appends the text of an in memory buffer
+  public: OutputBuffer &Write(const OutputBuffer &text)
+  {
+    return this->Write(&text.buffer[0], text.used);
+  }
+
+  /// Writes out whatever is in the buffer. Does nothing in memory
+  public: void Flush()
+  {
+    if (fd < 0)
+      return;
+    this->WriteAll(&buffer[0], used);
+    used = 0;
+  }
+
+  /// Forgets the text but keeps the memory
+  public: void Clear()
+  {
+    used = 0;
+  }
+
+  private: void MakeRoom(size_t length)
+  {
+    if (buffer.size() - used >= length)
+      return;
+    if (fd >= 0)
+      this->Flush();
+    else
+      buffer.resize(std::max(buffer.size() * 2, used + length));
+  }
+
+  private: void WriteAll(const char *data, size_t length)
+  {
+    while (length > 0)
+    {
+      ssize_t written = write(fd, data, length);
+      if (written < 0)
+      {
+        if (errno == EINTR)
+          continue;
+        std::ostringstream os;
+        os << "Failed to write output: " << strerror(errno);
+        SvgError x(os.str());
+        throw x;
+      }
+      data += written;
+      length -= written;
+    }
+  }
 
-   std::vector< std::vector<Point> > polylines;
+  /// -1 in memory
+  private: int fd;
+  private: std::vector<char> buffer;
+  private: size_t used;
 };
 
 
 
+// Cubic beziers waiting to be sampled evenly in t, kept one array per
+// coefficient. Each curve writes its points, except p0, into a slot
+// reserved beforehand in the points of a path, so the kernels below are
+// free to step several curves at once.
+class CubicBatch
+{
+  /// Queues a curve whose steps points go to points[offset...]
+  public: void Add(const Point &p0, const Point &p1, const Point &p2, const Point &p3,
+                   unsigned int steps, size_t offset)
+  {
+    // B(t) = a t^3 + b t^2 + c t + p0
+    ax.push_back(-p0.x + 3 * p1.x - 3 * p2.x + p3.x);
+    ay.push_back(-p0.y + 3 * p1.y - 3 * p2.y + p3.y);
+    bx.push_back(3 * p0.x - 6 * p1.x + 3 * p2.x);
+    by.push_back(3 * p0.y - 6 * p1.y + 3 * p2.y);
+    cx.push_back(-3 * p0.x + 3 * p1.x);
+    cy.push_back(-3 * p0.y + 3 * p1.y);
+    dx.push_back(p0.x);
+    dy.push_back(p0.y);
+    end.push_back(p3);
+    stepCounts.push_back(steps);
+    offsets.push_back(offset);
+  }
+
+  public: size_t Size() const { return end.size(); }
+
+  /// Forgets the curves but keeps the memory for the next path
+  public: void Clear()
+  {
+    ax.clear(); ay.clear(); bx.clear(); by.clear();
+    cx.clear(); cy.clear(); dx.clear(); dy.clear();
+    end.clear(); stepCounts.clear(); offsets.clear();
+  }
+
+  /// Fills in the points of every curve, with the fastest kernel the cpu has
+  public: void Evaluate(std::vector<Point> &points) const;
+
+  public: std::vector<double> ax, ay, bx, by, cx, cy, dx, dy;
+  public: std::vector<Point> end;
+  public: std::vector<unsigned int> stepCounts;
+  public: std::vector<size_t> offsets;
+};
+
+
 class SvgReader
 {
+  friend class SvgPathHandler;
+  friend class PathPipeline;
+
+  /// How curves are turned into polylines
+  public: enum Flattening
+  {
+    /// as few points as keep the polyline within resolution of the curve
+    ADAPTIVE,
+    /// evenly spaced in t, no more than resolution apart
+    UNIFORM
+  };
+
+  /// resolution is, for ADAPTIVE, the largest distance in user units allowed
+  /// between a curve and the polyline that replaces it and, for UNIFORM, the
+  /// largest distance between two points on a curve
+  public: SvgReader(double _resolution = 0.1, Flattening _flattening = ADAPTIVE)
+          : resolution(_resolution), flattening(_flattening), keepCommands(false) {}
 
-  public: SvgReader(){}
+  /// Whether Paths get their commands and subpaths as well as their
+  /// polylines. Without them, path data is flattened in a single pass
+  public: void KeepCommands(bool keep) { keepCommands = keep; }
 
   public: void Parse(const char*path, std::vector<Path> &paths);
-  public: void Dump_paths(const std::vector<Path> paths ) const;
+  /// Streams the file without building a DOM, handing each path to
+  /// onPath as soon as its element has been read
+  public: void ParseStreaming(const char*path, std::function<void (const Path &)> onPath);
+  /// Streams the file through handler, skipping what never holds a path
+  public: static void Stream(const char*path, TiXmlSaxHandler &handler);
+  public: void Dump_paths(const std::vector<Path> &paths, OutputBuffer &out) const;
+  public: void Dump_header(OutputBuffer &out) const;
+  public: void Dump_path(const Path &path, OutputBuffer &out) const;
+
+  /// The element and attribute names the reader looks at
+  private: enum NameKind
+  {
+    OTHER_NAME,
+    PATH_NAME,
+    STYLE_NAME,
+    ID_NAME,
+    D_NAME,
+    UNCLASSIFIED_NAME
+  };
+
+  private: static NameKind classify_name(const char *name);
+  private: NameKind classify_atom(const TiXmlDocument &doc, int atom);
+
+  private: void get_path_commands(const char *data, Path &path);
+  private: void get_path_attribs(const TiXmlDocument &doc, TiXmlElement* pElement, Path &path);
+  private: void get_path_attrib(const char *attribName, const char *attribValue, Path &path);
+  private: void get_path_attrib(NameKind kind, const char *attribValue, Path &path);
+  private: void get_svg_paths(const TiXmlDocument &doc, TiXmlNode* pParent, std::vector<Path> &paths);
+
+  private: static size_t ExpandedCount(const Command &cmd);
+  private: void ExpandCommands(const CommandList &cmds, const std::vector<size_t> &subpaths, Path &path);
+  private: void SplitSubpaths(const CommandList &cmds, std::vector<size_t> &subpaths);
+  private: void PathToPoints(const Path &path, double resolution, Flattening flattening, std::vector<Point> &points, std::vector<size_t> &polylines);
+
+  /// How far flattening a subpath has got
+  private: struct Pen
+  {
+    Pen(Point _last, size_t _first)
+      : last(_last), start(_last), first(_first), control(_last), curve(0) {}
 
-  private: void make_commands(char cmd, const std::vector<double> &numbers, std::vector<Command> &cmds);
-  private: void get_path_commands(const std::vector<std::string> &tokens, Path &path);
-  private: void get_path_attribs(TiXmlElement* pElement, Path &path);
-  private: void get_svg_paths(TiXmlNode* pParent, std::vector<Path> &paths);
+    /// the current point
+    Point last;
+    /// where z goes back to
+    Point start;
+    /// where the polyline of the subpath starts in points
+    size_t first;
+    /// the last control point of the previous command, for s and t to
+    /// reflect: curve is 'c' after a cubic, 'q' after a quadratic, else 0
+    Point control;
+    char curve;
+  };
 
-  private: void ExpandCommands(const std::vector< std::vector<Command> > &subpaths, Path &path);
-  private: void SplitSubpaths(const std::vector<Command> cmds, std::vector< std::vector<Command> > &split_cmds);
-  private: void PathToPoints(const Path &path, double resolution, std::vector< std::vector<Point> > &polys);
+  private: Point SubpathToPolyline(const std::vector<Segment> &commands, size_t begin, size_t end, Point last, double resolution, Flattening flattening, std::vector<Point> &points);
+  private: void FlattenCommand(char type, const double *numbers, Pen &pen, double resolution, Flattening flattening, std::vector<Point> &points);
+  private: void AddCubic(const Point &p0, const Point &p1, const Point &p2, const Point &p3, double resolution, Flattening flattening, std::vector<Point> &points);
+  private: static void AddArc(const Point &p0, double rx, double ry, double angle, bool largeArc, bool sweep, const Point &p, double resolution, Flattening flattening, std::vector<Point> &points);
+  private: void FlattenPathData(const char *data, Path &path);
 
-  private: Point SubpathToPolyline(const std::vector<Command> &subpath, Point last, std::vector<Point> &polyline);
+  private: double resolution;
+  private: Flattening flattening;
+  private: bool keepCommands;
+  /// UNIFORM curves of the path being flattened, evaluated together
+  private: CubicBatch cubics;
+  /// the commands of the path being read, before ExpandCommands
+  private: CommandList tokens;
+  /// where each subpath starts in tokens
+  private: std::vector<size_t> tokenSubpaths;
+  /// NameKind by atom for the document being read, filled in as names
+  /// are first met
+  private: std::vector<unsigned char> nameKinds;
 
 };
 
 
-std::string lowercase(const std::string& in)
+// Takes its copy by value, so a temporary is lowercased where it is
+std::string lowercase(std::string out)
 {
-  std::string out = in;
   std::transform(out.begin(), out.end(), out.begin(), ::tolower);
   return out;
 }
@@ -80,20 +566,10 @@ std::string lowercase(const std::string& in)
 
 std::string lowercase(const char* in)
 {
-  std::string ins = in;
-  return lowercase(ins);
+  return lowercase(std::string(in));
 }
 
 
-std::vector<std::string> &split(const std::string &s, char delim, std::vector<std::string> &elems) {
-    std::stringstream ss(s);
-    std::string item;
-    while (std::getline(ss, item, delim)) {
-        elems.push_back(item);
-    }
-    return elems;
-}
-
 Point bezierInterpolate(double t, const Point &p0, const Point &p1, const Point &p2, const Point &p3)
 {
   double t_1 = 1.0 - t;
@@ -116,248 +592,741 @@ double Distance(const Point &p0, const Point &p1)
   return sqrt(xx + yy);
 }
 
+/// The most points a single curve is sampled at, as for adaptive
+/// flattening: finite coordinates can still be too far apart to step
+/// through at resolution
+const unsigned int MAX_CURVE_STEPS = 1 << 16;
+
 unsigned int GetStepCount(const Point &p0, const Point &p1, const Point &p2, const Point &p3, double res)
 {
+  // the control polygon is never shorter than the curve
   double d = Distance(p0,p1) + Distance(p1,p2) + Distance(p2, p3);
-  double steps = res / d;
-  return (unsigned int) fabs(steps);
+  double steps = ceil(d / res);
+  if (steps < 1)
+    return 1;
+  // also catches a length that overflowed to inf
+  if (!(steps <= MAX_CURVE_STEPS))
+    return MAX_CURVE_STEPS;
+  return (unsigned int) steps;
 }
 
-
-Point SvgReader::SubpathToPolyline(const std::vector<Command> &subpath, Point last,  std::vector<Point> &polyline)
+// Squared distance from p to the segment a-b
+double SquaredDistanceToSegment(const Point &p, const Point &a, const Point &b)
 {
-  for (Command cmd: subpath)
+  double dx = b.x - a.x;
+  double dy = b.y - a.y;
+  double len2 = dx * dx + dy * dy;
+  double t = 0;
+  if (len2 > 0)
   {
-    if (cmd.type == 'm' || cmd.type == 'l')
-    {
-       size_t i =0;
-       size_t count = cmd.numbers.size();
-       while(i < count)
-       {
-         Point p;
-         p.x = cmd.numbers[i+0];
-         p.y = cmd.numbers[i+1];
-         // m and l cmds are relative to the last point
-         p.x += last.x;
-         p.y += last.y;
-         polyline.push_back(p);
-         last = p; 
-         i += 2;
-      }
-    }
+    t = ((p.x - a.x) * dx + (p.y - a.y) * dy) / len2;
+    t = std::max(0.0, std::min(1.0, t));
   }
-  return last;
+  double ex = a.x + t * dx - p.x;
+  double ey = a.y + t * dy - p.y;
+  return ex * ex + ey * ey;
 }
 
+Point Midpoint(const Point &p0, const Point &p1)
+{
+  Point p;
+  p.x = (p0.x + p1.x) * 0.5;
+  p.y = (p0.y + p1.y) * 0.5;
+  return p;
+}
 
-void SvgReader::SplitSubpaths(const std::vector<Command> cmds, std::vector< std::vector<Command> > &subpaths)
+// Appends the points of a cubic bezier, except p0, to polyline. The curve is
+// split in half until both control points are within tolerance of the chord.
+// Since the curve lies inside its control polygon, it is then within
+// tolerance of the chord too, so flat stretches get few points and tight
+// bends get many.
+void FlattenCubic(const Point &p0, const Point &p1, const Point &p2, const Point &p3,
+                  double tolerance2, std::vector<Point> &polyline, int depth = 0)
 {
-  if(cmds.size() ==0)
+  // 16 levels is MAX_CURVE_STEPS segments, enough for any curve that isn't
+  // degenerate
+  if (depth >= 16 ||
+      (SquaredDistanceToSegment(p1, p0, p3) <= tolerance2 &&
+       SquaredDistanceToSegment(p2, p0, p3) <= tolerance2))
   {
-    std::ostringstream os;
-    os << "Path has no commands";
-    SvgError x(os.str());
-    throw x;
+    polyline.push_back(p3);
+    return;
   }
-  
-  for(Command cmd: cmds)
-  {
-    if( tolower(cmd.type) == 'm')
-    {
-      // the path contains a subpath
-      std::vector<Command> sub;
-      subpaths.push_back(sub);
-    }
-    // get a reference to the latest subpath
-    std::vector<Command> &subpath = subpaths.back();
-    // give the cmd to the latest
-    subpath.push_back(cmd);
-  }  
+  // de Casteljau at t = 0.5
+  Point p01 = Midpoint(p0, p1);
+  Point p12 = Midpoint(p1, p2);
+  Point p23 = Midpoint(p2, p3);
+  Point p012 = Midpoint(p01, p12);
+  Point p123 = Midpoint(p12, p23);
+  Point mid = Midpoint(p012, p123);
+  FlattenCubic(p0, p01, p012, mid, tolerance2, polyline, depth + 1);
+  FlattenCubic(mid, p123, p23, p3, tolerance2, polyline, depth + 1);
 }
 
-void SvgReader::make_commands(char cmd, const std::vector<double> &numbers, std::vector<Command> &cmds)
+// The state of stepping curve k of the batch through t = i / steps: the
+// point, and its first, second and third differences, for x and for y. The
+// third difference is constant, so each point costs three additions per
+// axis instead of a full evaluation of the curve.
+struct ForwardDifferences
 {
-  if(cmd != 'x')
-  { 
-    Command c;
-    c.type = cmd;
-    c.numbers = numbers;
-    cmds.push_back(c);
+  ForwardDifferences(const CubicBatch &batch, size_t k)
+  {
+    double h = 1.0 / batch.stepCounts[k];
+    double h2 = h * h;
+    double h3 = h2 * h;
+    double ax = batch.ax[k], ay = batch.ay[k];
+    double bx = batch.bx[k], by = batch.by[k];
+    x[0] = batch.dx[k];
+    y[0] = batch.dy[k];
+    x[1] = ax * h3 + bx * h2 + batch.cx[k] * h;
+    y[1] = ay * h3 + by * h2 + batch.cy[k] * h;
+    x[2] = 6 * ax * h3 + 2 * bx * h2;
+    y[2] = 6 * ay * h3 + 2 * by * h2;
+    x[3] = 6 * ax * h3;
+    y[3] = 6 * ay * h3;
+  }
+
+  /// Writes points i to last - 1 to out[i - 1], having stepped to i - 1
+  void Step(unsigned int i, unsigned int last, Point *out)
+  {
+    for (; i < last; i++)
+    {
+      x[0] += x[1];
+      y[0] += y[1];
+      x[1] += x[2];
+      y[1] += y[2];
+      x[2] += x[3];
+      y[2] += y[3];
+      out[i - 1].x = x[0];
+      out[i - 1].y = y[0];
+    }
   }
 
+  double x[4];
+  double y[4];
+};
 
+// Writes the points of curve k of the batch, evenly spaced in t and except
+// p0, to out. The SIMD kernels below step several curves at once with the
+// same additions in the same order, so every kernel gives the same points.
+void ForwardDifferenceCubic(const CubicBatch &batch, size_t k, Point *out)
+{
+  unsigned int steps = batch.stepCounts[k];
+  ForwardDifferences differences(batch, k);
+  differences.Step(1, steps, out);
+  // land exactly on the end point, whatever rounding has accumulated
+  out[steps - 1] = batch.end[k];
 }
 
-void SvgReader::ExpandCommands(const std::vector< std::vector<Command> > &subpaths,  Path &path)
+static void EvaluateCubicsScalar(const CubicBatch &batch, std::vector<Point> &points)
 {
-  for (std::vector<Command> compressedSubpath :subpaths)
-  {
-    // add new subpath
-    path.subpaths.push_back( std::vector<Command>());
-    // get a reference	
-    std::vector<Command> &subpath = path.subpaths.back();
-    // copy the cmds with repeating commands, grouping the numbers
-    for (Command xCmd : compressedSubpath)
-    {
-      unsigned int numberCount = 0;      
-      if (tolower(xCmd.type) == 'c') 
-	numberCount = 6;
-      if (tolower(xCmd.type) == 'm')
-	numberCount = 2;
-      if (tolower(xCmd.type) == 'l')
-	numberCount = 2;
-      if (tolower(xCmd.type) == 'v')
-	numberCount = 1;
-      if (tolower(xCmd.type) == 'h')
-	numberCount = 1;
-      if (tolower(xCmd.type) == 'z')
-      {
-        subpath.push_back(xCmd);
-      }	
-      
-      // group numbers together and repeat the command
-      // for each group
-      unsigned int n = 0;
-      size_t size = xCmd.numbers.size();
+  for (size_t k = 0; k < batch.Size(); k++)
+    ForwardDifferenceCubic(batch, k, &points[batch.offsets[k]]);
+}
 
-      while(n < size)
-      {
-        subpath.push_back(Command());
-        Command &cmd = subpath.back();
-        cmd.type = xCmd.type;
-	
-     	for(size_t i=0; i < numberCount; i++)
-	    {
-	      cmd.numbers.push_back(xCmd.numbers[i+n]);
-	    }
-        n += numberCount;
-      } 
+#ifdef SVG_X86_KERNELS
+// The additions of one step form a chain from one point to the next, so a
+// single curve can't go faster than their latency. These kernels step
+// independent curves side by side instead, x and y of a curve in adjacent
+// lanes, for as many steps as the shortest of them has; each then finishes
+// on its own from where the lanes left it.
+
+// two curves, one per register
+__attribute__((target("sse2")))
+static void EvaluateCubicsSSE2(const CubicBatch &batch, std::vector<Point> &points)
+{
+  size_t k = 0;
+  for (; k + 2 <= batch.Size(); k += 2)
+  {
+    ForwardDifferences a(batch, k), b(batch, k + 1);
+    Point *outA = &points[batch.offsets[k]];
+    Point *outB = &points[batch.offsets[k + 1]];
+    unsigned int common = std::min(batch.stepCounts[k], batch.stepCounts[k + 1]);
+    __m128d fa = _mm_set_pd(a.y[0], a.x[0]), fb = _mm_set_pd(b.y[0], b.x[0]);
+    __m128d d1a = _mm_set_pd(a.y[1], a.x[1]), d1b = _mm_set_pd(b.y[1], b.x[1]);
+    __m128d d2a = _mm_set_pd(a.y[2], a.x[2]), d2b = _mm_set_pd(b.y[2], b.x[2]);
+    __m128d d3a = _mm_set_pd(a.y[3], a.x[3]), d3b = _mm_set_pd(b.y[3], b.x[3]);
+    for (unsigned int i = 1; i < common; i++)
+    {
+      fa = _mm_add_pd(fa, d1a);
+      fb = _mm_add_pd(fb, d1b);
+      d1a = _mm_add_pd(d1a, d2a);
+      d1b = _mm_add_pd(d1b, d2b);
+      d2a = _mm_add_pd(d2a, d3a);
+      d2b = _mm_add_pd(d2b, d3b);
+      _mm_storeu_pd(&outA[i - 1].x, fa);
+      _mm_storeu_pd(&outB[i - 1].x, fb);
     }
+    double lanes[2];
+    _mm_storeu_pd(lanes, fa); a.x[0] = lanes[0]; a.y[0] = lanes[1];
+    _mm_storeu_pd(lanes, d1a); a.x[1] = lanes[0]; a.y[1] = lanes[1];
+    _mm_storeu_pd(lanes, d2a); a.x[2] = lanes[0]; a.y[2] = lanes[1];
+    _mm_storeu_pd(lanes, fb); b.x[0] = lanes[0]; b.y[0] = lanes[1];
+    _mm_storeu_pd(lanes, d1b); b.x[1] = lanes[0]; b.y[1] = lanes[1];
+    _mm_storeu_pd(lanes, d2b); b.x[2] = lanes[0]; b.y[2] = lanes[1];
+    a.Step(common, batch.stepCounts[k], outA);
+    b.Step(common, batch.stepCounts[k + 1], outB);
+    outA[batch.stepCounts[k] - 1] = batch.end[k];
+    outB[batch.stepCounts[k + 1] - 1] = batch.end[k + 1];
   }
+  for (; k < batch.Size(); k++)
+    ForwardDifferenceCubic(batch, k, &points[batch.offsets[k]]);
 }
+#endif
 
-void SvgReader::get_path_commands(const std::vector<std::string> &tokens, Path &path)
-{
-     std::vector <Command> cmds;
-     std::string lookup = "cCmMlLvVhHzZ";
-     char lastCmd = 'x';
-     std::vector<double> numbers;
-     
-     for(std::string token: tokens)
-     {
-       // new command?
-       if(lookup.find(token[0]) == std::string::npos)
-       { 
-         // its just numbers
-         std::cout << std::endl;
-         std::vector<std::string> numberStrs;
-         split(token, ',', numberStrs);
-         for(std::string numberStr : numberStrs)
-         {
-           double f = atof(numberStr.c_str());
-           numbers.push_back(f);
-         }
-       }
-       else
-       {
-         
-         if(lastCmd != 'x')
-         { 
-           Command c;
-           c.type = lastCmd;
-           c.numbers = numbers;
-           cmds.push_back(c);
-         }
-
-         // its new command
-         lastCmd = token[0];
-         numbers.resize(0);
-       }
-     }
-     // the last command
-     if(lastCmd != 'x')
-     { 
-       Command c;
-       c.type = lastCmd;
-       c.numbers = numbers;
-       cmds.push_back(c);
-     }
-    // split the commands into sub_paths 
-    std::vector< std::vector< Command> > subpaths;
-    this->SplitSubpaths(cmds, subpaths);
+typedef void (*CubicKernel)(const CubicBatch &, std::vector<Point> &);
 
-    this->ExpandCommands(subpaths, path );
+// Picks the kernel once, on first use. Stepping four curves in the 256 bit
+// registers of AVX2 measured slower than two in SSE2 (see bench.cc): each
+// point then has to be extracted from its half of a register, and four
+// curves share fewer steps than two.
+static CubicKernel SelectCubicKernel()
+{
+#ifdef SVG_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    return EvaluateCubicsSSE2;
+#endif
+  return EvaluateCubicsScalar;
+}
 
-    // the starting point for the subpath
-    // it is the end point of the previous one
-    Point p;
-    p.x = 0;
-    p.y = 0;
-    for (std::vector<Command> subpath : subpaths)
-    {
-        path.polylines.push_back(std::vector<Point>());
-        std::vector<Point> &polyline = path.polylines.back();
-        
-    	std::cout << "XXX " << polyline.size() << std::endl;
-        p = this->SubpathToPolyline(subpath, p, polyline);
-        std::cout << "X X X " << polyline.size() << std::endl;
-    }
-        
+void CubicBatch::Evaluate(std::vector<Point> &points) const
+{
+  static const CubicKernel kernel = SelectCubicKernel();
+  kernel(*this, points);
 }
 
-void SvgReader::get_path_attribs(TiXmlElement* pElement, Path &path)
+
+Point SvgReader::SubpathToPolyline(const std::vector<Segment> &commands, size_t begin, size_t end, Point last, double resolution, Flattening flattening, std::vector<Point> &points)
 {
-    if ( !pElement ) return;
+  Pen pen(last, points.size());
+  for (size_t i = begin; i < end; i++)
+  {
+    const Segment &segment = commands[i];
+    this->FlattenCommand(segment.type, segment.numbers, pen, resolution, flattening, points);
+  }
+  return pen.last;
+}
 
-    TiXmlAttribute* pAttrib=pElement->FirstAttribute();
-    while (pAttrib)
+/// Adds the points of one command, with its numbers, to the polyline the
+/// pen is drawing, and moves the pen on
+void SvgReader::FlattenCommand(char type, const double *numbers, Pen &pen, double resolution, Flattening flattening, std::vector<Point> &points)
+{
+    // lower case commands are relative to the last point
+    Point origin = pen.last;
+    if (isupper(type))
+    {
+      origin.x = 0;
+      origin.y = 0;
+    }
+    const Point &last = pen.last;
+    Point p;
+    // what s and t reflect after this command, if anything
+    char curve = 0;
+    Point control;
+    switch (tolower(type))
     {
-        std::string name = lowercase(pAttrib->Name());
-        std::string value= lowercase(pAttrib->Value());
-        if (name == "style")
+      case 'm':
+      case 'l':
+        p.x = origin.x + numbers[0];
+        p.y = origin.y + numbers[1];
+        if (points.size() == pen.first)
+          pen.start = p;
+        points.push_back(p);
+        break;
+      case 'h':
+        p.x = origin.x + numbers[0];
+        p.y = last.y;
+        points.push_back(p);
+        break;
+      case 'v':
+        p.x = last.x;
+        p.y = origin.y + numbers[0];
+        points.push_back(p);
+        break;
+      case 'c':
+      case 's':
+      {
+        Point p1, p2;
+        const double *n = numbers;
+        if (tolower(type) == 'c')
         {
-            path.style = value;
+          p1.x = origin.x + n[0];
+          p1.y = origin.y + n[1];
+          n += 2;
         }
-        if (name == "id")
+        else if (pen.curve == 'c')
         {
-            path.id = value;
+          // the reflection of the second control point of the last curve
+          p1.x = 2 * last.x - pen.control.x;
+          p1.y = 2 * last.y - pen.control.y;
         }
-        if (name == "d")
+        else
+          p1 = last;
+        p2.x = origin.x + n[0];
+        p2.y = origin.y + n[1];
+        p.x = origin.x + n[2];
+        p.y = origin.y + n[3];
+        this->AddCubic(last, p1, p2, p, resolution, flattening, points);
+        curve = 'c';
+        control = p2;
+        break;
+      }
+      case 'q':
+      case 't':
+      {
+        Point q;
+        const double *n = numbers;
+        if (tolower(type) == 'q')
         {
-            using namespace std;
-            // this attribute contains a list of coordinates
-            std::vector<std::string> tokens;
-            split(value, ' ', tokens);
-            get_path_commands(tokens, path);
-            
+          q.x = origin.x + n[0];
+          q.y = origin.y + n[1];
+          n += 2;
         }
-        // int ival;
-        // double dval;
-        // if (pAttrib->QueryIntValue(&ival)==TIXML_SUCCESS)    printf( " int=%d", ival);
-        // if (pAttrib->QueryDoubleValue(&dval)==TIXML_SUCCESS) printf( " d=%1.1f", dval);
-        pAttrib=pAttrib->Next();
+        else if (pen.curve == 'q')
+        {
+          q.x = 2 * last.x - pen.control.x;
+          q.y = 2 * last.y - pen.control.y;
+        }
+        else
+          q = last;
+        p.x = origin.x + n[0];
+        p.y = origin.y + n[1];
+        // a quadratic is the cubic with control points 2/3 of the way to q
+        Point p1, p2;
+        p1.x = last.x + 2.0 / 3.0 * (q.x - last.x);
+        p1.y = last.y + 2.0 / 3.0 * (q.y - last.y);
+        p2.x = p.x + 2.0 / 3.0 * (q.x - p.x);
+        p2.y = p.y + 2.0 / 3.0 * (q.y - p.y);
+        this->AddCubic(last, p1, p2, p, resolution, flattening, points);
+        curve = 'q';
+        control = q;
+        break;
+      }
+      case 'a':
+        p.x = origin.x + numbers[5];
+        p.y = origin.y + numbers[6];
+        AddArc(last, numbers[0], numbers[1], numbers[2], numbers[3] != 0, numbers[4] != 0, p, resolution, flattening, points);
+        break;
+      case 'z':
+        if (last.x != pen.start.x || last.y != pen.start.y)
+          points.push_back(pen.start);
+        p = pen.start;
+        break;
     }
+    pen.last = p;
+    pen.curve = curve;
+    pen.control = control;
 }
 
+void SvgReader::AddCubic(const Point &p0, const Point &p1, const Point &p2, const Point &p3, double resolution, Flattening flattening, std::vector<Point> &points)
+{
+  if (flattening == UNIFORM)
+  {
+    // leave room for the points, PathToPoints fills them in
+    unsigned int steps = GetStepCount(p0, p1, p2, p3, resolution);
+    this->cubics.Add(p0, p1, p2, p3, steps, points.size());
+    points.resize(points.size() + steps);
+  }
+  else
+    FlattenCubic(p0, p1, p2, p3, resolution * resolution, points);
+}
 
-void SvgReader::get_svg_paths(TiXmlNode* pParent, std::vector<Path> &paths)
+/// Adds the points of an elliptical arc from p0 to p, given as in path data
+/// (SVG 1.1, appendix F.6.5 and F.6.6). The arc is put in centre form once
+/// and its points found by turning a unit vector through equal steps, so
+/// there are no sines or cosines per point
+void SvgReader::AddArc(const Point &p0, double rx, double ry, double angle, bool largeArc, bool sweep, const Point &p, double resolution, Flattening flattening, std::vector<Point> &points)
 {
-    if ( !pParent ) return;
+  // an arc to where it starts is left out altogether
+  if (p0.x == p.x && p0.y == p.y)
+    return;
+  rx = fabs(rx);
+  ry = fabs(ry);
+  if (rx == 0 || ry == 0)
+  {
+    points.push_back(p);
+    return;
+  }
+  double phi = angle * M_PI / 180;
+  double cosPhi = cos(phi);
+  double sinPhi = sin(phi);
 
-    TiXmlNode* pChild;
-    TiXmlText* pText;
-    int t = pParent->Type();
-    int num;
-    std::string name;
-    switch ( t )
-    {
-      case TiXmlNode::TINYXML_ELEMENT:
-        name = lowercase(pParent->Value());
-        if (name == "path")
+  // the start point in coordinates centred between the ends, along the axes
+  double dx = (p0.x - p.x) / 2;
+  double dy = (p0.y - p.y) / 2;
+  double x1 = cosPhi * dx + sinPhi * dy;
+  double y1 = -sinPhi * dx + cosPhi * dy;
+
+  // radii too small to reach are scaled up until they just do
+  double lambda = (x1 * x1) / (rx * rx) + (y1 * y1) / (ry * ry);
+  if (lambda > 1)
+  {
+    rx *= sqrt(lambda);
+    ry *= sqrt(lambda);
+  }
+
+  // the centre
+  double rx2 = rx * rx;
+  double ry2 = ry * ry;
+  double num = rx2 * ry2 - rx2 * y1 * y1 - ry2 * x1 * x1;
+  double den = rx2 * y1 * y1 + ry2 * x1 * x1;
+  double coef = sqrt(std::max(0.0, num / den));
+  if (largeArc == sweep)
+    coef = -coef;
+  double cx1 = coef * rx * y1 / ry;
+  double cy1 = -coef * ry * x1 / rx;
+  double cx = cosPhi * cx1 - sinPhi * cy1 + (p0.x + p.x) / 2;
+  double cy = sinPhi * cx1 + cosPhi * cy1 + (p0.y + p.y) / 2;
+
+  // the angles on the unit circle the arc starts at and turns through
+  double ux = (x1 - cx1) / rx;
+  double uy = (y1 - cy1) / ry;
+  double vx = (-x1 - cx1) / rx;
+  double vy = (-y1 - cy1) / ry;
+  double theta = atan2(uy, ux);
+  double delta = atan2(ux * vy - uy * vx, ux * vx + uy * vy);
+  if (!sweep && delta > 0)
+    delta -= 2 * M_PI;
+  else if (sweep && delta < 0)
+    delta += 2 * M_PI;
+
+  // as many equal steps as keep the polyline within resolution of the
+  // larger circle the ellipse fits in or, for UNIFORM, the points no more
+  // than resolution apart along it
+  double r = std::max(rx, ry);
+  double count = 1;
+  if (flattening == UNIFORM)
+    count = ceil(fabs(delta) * r / resolution);
+  else if (resolution < r)
+  {
+    // a step whose chord is resolution from the arc: 1 - cos(step / 2) is
+    // resolution / r, written so that it doesn't round to 0 for huge radii.
+    // Should it still, step by arc length instead
+    double largest = 4 * asin(sqrt(resolution / (2 * r)));
+    if (largest == 0)
+      largest = resolution / r;
+    count = ceil(fabs(delta) / largest);
+  }
+  if (count < 1)
+    count = 1;
+  // also catches a count that overflowed to inf
+  if (!(count <= MAX_CURVE_STEPS))
+    count = MAX_CURVE_STEPS;
+  size_t steps = (size_t) count;
+  double step = delta / steps;
+  double cosStep = cos(step);
+  double sinStep = sin(step);
+
+  // scales the unit circle to the radii, then rotates it by phi
+  double xx = rx * cosPhi, xy = -ry * sinPhi;
+  double yx = rx * sinPhi, yy = ry * cosPhi;
+  double u = cos(theta);
+  double v = sin(theta);
+  for (size_t i = 1; i < steps; i++)
+  {
+    double t = u * cosStep - v * sinStep;
+    v = u * sinStep + v * cosStep;
+    u = t;
+    Point q;
+    q.x = cx + xx * u + xy * v;
+    q.y = cy + yx * u + yy * v;
+    points.push_back(q);
+  }
+  // the arc ends exactly where it was asked to
+  points.push_back(p);
+}
+
+void SvgReader::PathToPoints(const Path &path, double resolution, Flattening flattening, std::vector<Point> &points, std::vector<size_t> &polylines)
+{
+  // the starting point for the subpath
+  // it is the end point of the previous one
+  Point p;
+  p.x = 0;
+  p.y = 0;
+  // at least a point per command, curves add more
+  points.reserve(points.size() + path.commands.size());
+  polylines.reserve(polylines.size() + path.subpaths.size());
+  for (size_t i = 0; i < path.subpaths.size(); i++)
+  {
+    size_t end = i + 1 < path.subpaths.size() ? path.subpaths[i + 1] : path.commands.size();
+    polylines.push_back(points.size());
+    p = this->SubpathToPolyline(path.commands, path.subpaths[i], end, p, resolution, flattening, points);
+  }
+  // all the curves of the path at once, several points per instruction
+  this->cubics.Evaluate(points);
+  this->cubics.Clear();
+}
+
+
+void SvgReader::SplitSubpaths(const CommandList &cmds, std::vector<size_t> &subpaths)
+{
+  if(cmds.size() ==0)
+  {
+    std::ostringstream os;
+    os << "Path has no commands";
+    SvgError x(os.str());
+    throw x;
+  }
+  
+  if (tolower(cmds.types[0]) != 'm')
+  {
+    std::ostringstream os;
+    os << "Path does not start with a moveto";
+    SvgError x(os.str());
+    throw x;
+  }
+
+  for (size_t i = 0; i < cmds.size(); i++)
+  {
+    if( tolower(cmds.types[i]) == 'm')
+    {
+      // the path contains a subpath
+      subpaths.push_back(i);
+    }
+  }  
+}
+
+/// The commands cmd stands for once its numbers are grouped, one per
+/// repetition
+size_t SvgReader::ExpandedCount(const Command &cmd)
+{
+  unsigned int numberCount = NumberCount(cmd.type);
+  size_t size = cmd.numbers.size();
+  if (numberCount == 0 ? size != 0 : size % numberCount != 0)
+  {
+    std::ostringstream os;
+    os << "Wrong number of coordinates for '" << cmd.type << "' command: " << size;
+    SvgError x(os.str());
+    throw x;
+  }
+  if (tolower(cmd.type) == 'z')
+    return 1;
+  return numberCount == 0 ? 0 : size / numberCount;
+}
+
+void SvgReader::ExpandCommands(const CommandList &cmds, const std::vector<size_t> &subpaths, Path &path)
+{
+  // only the letters are repeated, so the commands of the path are sized
+  // before they are added
+  size_t count = 0;
+  for (size_t i = 0; i < cmds.size(); i++)
+    count += ExpandedCount(cmds[i]);
+  path.commands.reserve(path.commands.size() + count);
+  path.subpaths.reserve(path.subpaths.size() + subpaths.size());
+
+  for (size_t s = 0; s < subpaths.size(); s++)
+  {
+    // add new subpath
+    path.subpaths.push_back(path.commands.size());
+    size_t end = s + 1 < subpaths.size() ? subpaths[s + 1] : cmds.size();
+    // copy the cmds with repeating commands, grouping the numbers
+    for (size_t i = subpaths[s]; i < end; i++)
+    {
+      Command xCmd = cmds[i];
+      Segment segment;
+      segment.type = xCmd.type;
+      if (tolower(xCmd.type) == 'z')
+      {
+        path.commands.push_back(segment);
+        continue;
+      }
+      // repeat the command for each group of numbers
+      unsigned int numberCount = NumberCount(xCmd.type);
+      for (const double *n = xCmd.numbers.begin(); n < xCmd.numbers.end(); n += numberCount)
+      {
+        std::copy(n, n + numberCount, segment.numbers);
+        path.commands.push_back(segment);
+      }
+    }
+  }
+}
+
+/// Does what get_path_commands does in one pass over data, flattening each
+/// command as soon as its numbers have been read. Nothing but the points
+/// and polylines of path is stored
+void SvgReader::FlattenPathData(const char *data, Path &path)
+{
+    // curves a bad path left behind are not this one's
+    this->cubics.Clear();
+    // a point takes two numbers, about twenty characters, and curves add
+    // more, so this saves most of the regrowing
+    path.points.reserve(path.points.size() + strlen(data) / 20);
+    PathTokenizer tokenizer(data);
+    Point origin;
+    origin.x = 0;
+    origin.y = 0;
+    Pen pen(origin, path.points.size());
+    bool any = false;
+    char type;
+    while (tokenizer.NextCommand(type))
+    {
+      if (!any && tolower(type) != 'm')
+      {
+        std::ostringstream os;
+        os << "Path does not start with a moveto";
+        SvgError x(os.str());
+        throw x;
+      }
+      any = true;
+      if (tolower(type) == 'm')
+      {
+        // a new subpath, starting from the end of the last one
+        path.polylines.push_back(path.points.size());
+        pen = Pen(pen.last, path.points.size());
+      }
+      // each group of numbers is a command of its own
+      unsigned int numberCount = NumberCount(type);
+      double numbers[Segment::MAX_NUMBERS];
+      size_t size = 0;
+      double number;
+      while (tokenizer.NextArgument(type, numberCount ? size % numberCount : size, number))
+      {
+        if (numberCount == 0)
         {
-          Path p;
-          get_path_attribs(pParent->ToElement(), p);
-          paths.push_back(p);
+          size++;
+          continue;
+        }
+        numbers[size++ % numberCount] = number;
+        if (size % numberCount == 0)
+          this->FlattenCommand(type, numbers, pen, this->resolution, this->flattening, path.points);
+      }
+      if (numberCount == 0 ? size != 0 : size % numberCount != 0)
+      {
+        std::ostringstream os;
+        os << "Wrong number of coordinates for '" << type << "' command: " << size;
+        SvgError x(os.str());
+        throw x;
+      }
+      if (tolower(type) == 'z')
+        this->FlattenCommand(type, numbers, pen, this->resolution, this->flattening, path.points);
+    }
+    if (!any)
+    {
+      std::ostringstream os;
+      os << "Path has no commands";
+      SvgError x(os.str());
+      throw x;
+    }
+    // all the curves of the path at once, several points per instruction
+    this->cubics.Evaluate(path.points);
+    this->cubics.Clear();
+}
+
+void SvgReader::get_path_commands(const char *data, Path &path)
+{
+    if (!this->keepCommands)
+    {
+      this->FlattenPathData(data, path);
+      return;
+    }
+    // reused from path to path, like cubics
+    CommandList &cmds = this->tokens;
+    cmds.clear();
+    PathTokenizer tokenizer(data);
+    char type;
+    while (tokenizer.NextCommand(type))
+    {
+      cmds.Add(type);
+      unsigned int numberCount = NumberCount(type);
+      double number;
+      for (size_t i = 0; tokenizer.NextArgument(type, numberCount ? i % numberCount : i, number); i++)
+      {
+        cmds.AddNumber(number);
+      }
+    }
+
+    // split the commands into sub_paths 
+    std::vector<size_t> &subpaths = this->tokenSubpaths;
+    subpaths.clear();
+    this->SplitSubpaths(cmds, subpaths);
+
+    this->ExpandCommands(cmds, subpaths, path);
+
+    this->PathToPoints(path, this->resolution, this->flattening, path.points, path.polylines);
+}
+
+SvgReader::NameKind SvgReader::classify_name(const char *name)
+{
+    if (strcasecmp(name, "path") == 0)
+      return PATH_NAME;
+    if (strcasecmp(name, "style") == 0)
+      return STYLE_NAME;
+    if (strcasecmp(name, "id") == 0)
+      return ID_NAME;
+    if (strcasecmp(name, "d") == 0)
+      return D_NAME;
+    return OTHER_NAME;
+}
+
+SvgReader::NameKind SvgReader::classify_atom(const TiXmlDocument &doc, int atom)
+{
+    // each distinct name is compared once, every later use is a lookup
+    if (atom >= (int)nameKinds.size())
+      nameKinds.resize(doc.AtomCount(), UNCLASSIFIED_NAME);
+    if (nameKinds[atom] == UNCLASSIFIED_NAME)
+      nameKinds[atom] = atom ? classify_name(doc.AtomName(atom)) : OTHER_NAME;
+    return (NameKind)nameKinds[atom];
+}
+
+void SvgReader::get_path_attribs(const TiXmlDocument &doc, TiXmlElement* pElement, Path &path)
+{
+    if ( !pElement ) return;
+
+    TiXmlAttribute* pAttrib=pElement->FirstAttribute();
+    while (pAttrib)
+    {
+        get_path_attrib(classify_atom(doc, pAttrib->Atom()), pAttrib->Value(), path);
+        // int ival;
+        // double dval;
+        // if (pAttrib->QueryIntValue(&ival)==TIXML_SUCCESS)    printf( " int=%d", ival);
+        // if (pAttrib->QueryDoubleValue(&dval)==TIXML_SUCCESS) printf( " d=%1.1f", dval);
+        pAttrib=pAttrib->Next();
+    }
+}
+
+void SvgReader::get_path_attrib(const char *attribName, const char *attribValue, Path &path)
+{
+    // names are compared where they are, only kept values are copied
+    get_path_attrib(classify_name(attribName), attribValue, path);
+}
+
+void SvgReader::get_path_attrib(NameKind kind, const char *attribValue, Path &path)
+{
+    switch (kind)
+    {
+      case STYLE_NAME:
+        path.style = lowercase(attribValue);
+        break;
+      case ID_NAME:
+        path.id = lowercase(attribValue);
+        break;
+      case D_NAME:
+        // this attribute contains a list of coordinates, read in place
+        get_path_commands(attribValue, path);
+        break;
+      default:
+        break;
+    }
+}
+
+
+void SvgReader::get_svg_paths(const TiXmlDocument &doc, TiXmlNode* pParent, std::vector<Path> &paths)
+{
+    if ( !pParent ) return;
+
+    TiXmlNode* pChild;
+    TiXmlText* pText;
+    int t = pParent->Type();
+    int num;
+    switch ( t )
+    {
+      case TiXmlNode::TINYXML_ELEMENT:
+        if (classify_atom(doc, pParent->Atom()) == PATH_NAME)
+        {
+          // filled in place, a Path is too big to copy
+          paths.push_back(Path());
+          get_path_attribs(doc, pParent->ToElement(), paths.back());
         }
         break; 
 
@@ -367,14 +1336,28 @@ void SvgReader::get_svg_paths(TiXmlNode* pParent, std::vector<Path> &paths)
 
   for ( pChild = pParent->FirstChild(); pChild != 0; pChild = pChild->NextSibling())
   {
-      get_svg_paths( pChild, paths );
+      get_svg_paths( doc, pChild, paths );
   }
 }
 
+// Elements that never hold a path, skipped unread. Embedded images can be
+// most of a file. Not defs: clip paths, markers and symbols hold paths.
+static const char SKIPPED_ELEMENTS[] =
+  "metadata sodipodi:namedview image linearGradient radialGradient";
+
 // load the named file and dump its structure to STDOUT
 void SvgReader::Parse(const char* pFilename, std::vector<Path> &paths)
 {
     TiXmlDocument doc(pFilename);
+    // parse straight out of the page cache, large drawings are not copied
+    doc.SetMemoryMapped(true);
+    // the whole tree is thrown away at once when doc goes out of scope
+    doc.SetArenaAllocated(true);
+    // attribute values, the path data above all, are read where they are
+    doc.SetInSitu(true);
+    // the rows and columns of the nodes are never looked at
+    doc.SetLocationTracking(false);
+    doc.SetElementFilter(SKIPPED_ELEMENTS, TIXML_FILTER_DENY);
     bool loadOkay = doc.LoadFile();
     if (!loadOkay)
     {
@@ -384,62 +1367,675 @@ void SvgReader::Parse(const char* pFilename, std::vector<Path> &paths)
       throw x;
     }
 
-  get_svg_paths( &doc, paths);
+  // atoms belong to doc, the kinds of the last file's mean nothing here
+  nameKinds.clear();
+  get_svg_paths( doc, &doc, paths);
+
+}
+
+// Receives the elements of the file as they are parsed and builds one
+// Path at a time. Only the path element being read is ever in memory.
+class SvgPathHandler : public TiXmlSaxHandler
+{
+  public: SvgPathHandler(SvgReader &_reader, std::function<void (const Path &)> _onPath)
+          : reader(_reader), onPath(_onPath), inPathTag(false) {}
 
+  public: virtual bool StartElement(const char *name)
+  {
+    // attributes always follow their element's start tag, before any child
+    inPathTag = strcasecmp(name, "path") == 0;
+    if (inPathTag)
+    {
+      path.clear();
+    }
+    return true;
+  }
+
+  public: virtual bool Attribute(const char *name, const char *value)
+  {
+    if (inPathTag)
+    {
+      reader.get_path_attrib(name, value, path);
+    }
+    return true;
+  }
+
+  public: virtual bool EndElement(const char *name)
+  {
+    if (strcasecmp(name, "path") == 0)
+    {
+      onPath(path);
+    }
+    inPathTag = false;
+    return true;
+  }
+
+  private: SvgReader &reader;
+  private: std::function<void (const Path &)> onPath;
+  private: bool inPathTag;
+  private: Path path;
+};
+
+void SvgReader::ParseStreaming(const char* pFilename, std::function<void (const Path &)> onPath)
+{
+    SvgPathHandler handler(*this, onPath);
+    Stream(pFilename, handler);
+}
+
+void SvgReader::Stream(const char* pFilename, TiXmlSaxHandler &handler)
+{
+    TiXmlDocument doc(pFilename);
+    doc.SetMemoryMapped(true);
+    doc.SetInSitu(true);
+    doc.SetLocationTracking(false);
+    doc.SetElementFilter(SKIPPED_ELEMENTS, TIXML_FILTER_DENY);
+    bool loadOkay = doc.SaxLoadFile(pFilename, &handler);
+    if (!loadOkay)
+    {
+      std::ostringstream os;
+      os << "Failed to load file " <<  pFilename;
+      SvgError x(os.str());
+      throw x;
+    }
 }
 
-void SvgReader::Dump_paths(const std::vector<Path> paths ) const
+void SvgReader::Dump_paths(const std::vector<Path> &paths, OutputBuffer &out) const
 {
-  std::cout << "var svg = [];" << std::endl;
-  for (Path path : paths)
+  this->Dump_header(out);
+  for (const Path &path : paths)
   {
-    std::cout << "svg.push({name:\"" << path.id <<  "\", subpaths:[], style: \"" << path.style << "\"}); " << std::endl;
+    this->Dump_path(path, out);
+  }
+}
+
+void SvgReader::Dump_header(OutputBuffer &out) const
+{
+  out << "var svg = [];\n";
+}
+
+void SvgReader::Dump_path(const Path &path, OutputBuffer &out) const
+{
+    out << "svg.push({name:\"" << path.id <<  "\", subpaths:[], style: \"" << path.style << "\"}); \n";
     // std::cout << " -" << path.id << " " << path.style << std::endl;
-//    for (std::vector<Command> subpath : path.subpaths)
+//    for (size_t i = 0; i < path.commands.size(); i++)
 //    {
-      // std::cout << "//  subpath (" << subpath.size() << " cmds)" << std::endl;
-      // for (Command cmd: subpath)
-      // {
-        // std::cout << "//    " << cmd.tostr() << std::endl;
-     // }
+      // std::cout << "//    " << path.commands[i].tostr() << std::endl;
 //    }
-    std::cout << "svg[svg.length-1].subpaths = [";
+    out << "svg[svg.length-1].subpaths = [";
     char psep = ' ';
-    for (unsigned int i=0; i < path.polylines.size(); i++)
+    for (size_t i=0; i < path.PolylineCount(); i++)
     {
-      std::vector<Point> poly = path.polylines[i];
-      std::cout << psep <<  "[" << std::endl;
+      Span<Point> poly = path.Polyline(i);
+      out << psep <<  "[\n";
       psep = ',';
       char sep = ' ';
       for( Point p : poly)
       {
-        std::cout << " " << sep << " [" <<  p.x << ", " << p.y << "]" <<std::endl;
+        out << " " << sep << " [" <<  p.x << ", " << p.y << "]\n";
 	    sep = ',';
       }
-      std::cout << " ] " << std::endl;
+      out << " ] \n";
+    }
+    out << "];\n";
+    out << "\n\n";
+}
+
+// Prints one file, the way main() lays it out
+void ProcessFile(SvgReader &svg, const char *filename, bool streaming, OutputBuffer &out)
+{
+  out << "=========\nFILE: " << filename << "\n";
+  if (streaming)
+  {
+    svg.Dump_header(out);
+    svg.ParseStreaming(filename, [&svg, &out](const Path &path) { svg.Dump_path(path, out); });
+  }
+  else
+  {
+    std::vector<Path> paths;
+    svg.Parse(filename, paths);
+    svg.Dump_paths(paths, out);
+  }
+}
+
+/// The files of a -j run, one list per thread. A thread starts with every
+/// Nth file and takes from the front of its own list, so files finish
+/// roughly in order. Once its list is empty it steals from the back of the
+/// others', which are the files needed last, as long as they come before
+/// the limit it is given; otherwise it takes the front.
+class FileQueues
+{
+  public: FileQueues(int count, unsigned int threads)
+  {
+    for (unsigned int t = 0; t < threads; t++)
+      queues.push_back(std::unique_ptr<Queue>(new Queue));
+    for (int i = 0; i < count; i++)
+      queues[i % threads]->files.push_back(i);
+  }
+
+  /// Gives thread the next file before limit, or -1 if every file left is
+  /// at limit or past it. Returns false when none is left
+  public: bool Next(unsigned int thread, int limit, int &file)
+  {
+    bool left = false;
+    file = -1;
+    {
+      Queue &own = *queues[thread];
+      std::lock_guard<std::mutex> guard(own.lock);
+      if (!own.files.empty())
+      {
+        left = true;
+        if (own.files.front() < limit)
+        {
+          file = own.files.front();
+          own.files.pop_front();
+          return true;
+        }
+      }
+    }
+    for (size_t i = 1; i < queues.size(); i++)
+    {
+      Queue &victim = *queues[(thread + i) % queues.size()];
+      std::lock_guard<std::mutex> guard(victim.lock);
+      if (victim.files.empty())
+        continue;
+      left = true;
+      if (victim.files.back() < limit)
+      {
+        file = victim.files.back();
+        victim.files.pop_back();
+        return true;
+      }
+      // each list is in order, so its front is the first of its files
+      if (victim.files.front() < limit)
+      {
+        file = victim.files.front();
+        victim.files.pop_front();
+        return true;
+      }
+    }
+    return left;
+  }
+
+  private: struct Queue
+  {
+    std::mutex lock;
+    std::deque<int> files;
+  };
+  private: std::vector< std::unique_ptr<Queue> > queues;
+};
+
+// Parses and flattens files on threads, each with its own SvgReader, and
+// prints them to out in the order they were given. Each file is printed to
+// memory first; those buffers go back to the threads once written out, so
+// after the first few files nothing large is allocated. No more than two
+// files per thread are taken ahead of the one being written, so a slow file
+// early on doesn't leave the rest piling up in memory. An error in a file
+// is thrown once all the files before it, and what that file printed
+// before the error, have been printed.
+void ProcessFiles(char *files[], int count, unsigned int threads, double resolution,
+                  SvgReader::Flattening flattening, bool streaming, OutputBuffer &out)
+{
+  struct Result
+  {
+    std::unique_ptr<OutputBuffer> text;
+    std::exception_ptr error;
+    bool done;
+  };
+  std::vector<Result> results(count);
+  for (Result &result : results)
+    result.done = false;
+  std::vector< std::unique_ptr<OutputBuffer> > spare;
+  std::mutex lock;
+  std::condition_variable finished;
+  // signalled when a file has been written out, or on stop
+  std::condition_variable advanced;
+  std::atomic<bool> stop(false);
+  FileQueues queues(count, threads);
+  // the files written out so far, and how far past them threads may go
+  int written = 0;
+  const int window = 2 * threads;
+
+  std::vector<std::thread> workers;
+  for (unsigned int t = 0; t < threads; t++)
+  {
+    workers.push_back(std::thread([&, t]()
+    {
+      SvgReader svg(resolution, flattening);
+      while (!stop)
+      {
+        int i;
+        std::unique_ptr<OutputBuffer> text;
+        {
+          std::unique_lock<std::mutex> guard(lock);
+          if (!queues.Next(t, written + window, i))
+            break;
+          if (i < 0)
+          {
+            // the file being written is ahead of every one left; wait for it
+            advanced.wait(guard);
+            continue;
+          }
+          if (!spare.empty())
+          {
+            text = std::move(spare.back());
+            spare.pop_back();
+          }
+        }
+        std::exception_ptr error;
+        try
+        {
+          if (!text)
+            text.reset(new OutputBuffer());
+          ProcessFile(svg, files[i], streaming, *text);
+        }
+        catch (...)
+        {
+          error = std::current_exception();
+        }
+        {
+          std::lock_guard<std::mutex> guard(lock);
+          results[i].text = std::move(text);
+          results[i].error = error;
+          results[i].done = true;
+        }
+        finished.notify_all();
+      }
+    }));
+  }
+
+  std::exception_ptr error;
+  for (int i = 0; i < count && !error; i++)
+  {
+    std::unique_ptr<OutputBuffer> text;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      finished.wait(guard, [&]() { return results[i].done; });
+      text = std::move(results[i].text);
+      error = results[i].error;
+    }
+    // a file that failed still prints what it got to, as it would alone
+    try
+    {
+      if (text)
+      {
+        out.Write(*text);
+        out.Flush();
+      }
+    }
+    catch (...)
+    {
+      if (!error)
+        error = std::current_exception();
+    }
+    if (error)
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      stop = true;
+      break;
+    }
+    text->Clear();
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      spare.push_back(std::move(text));
+      written = i + 1;
     }
-    std::cout << "];" << std::endl;
-    std::cout << "\n\n";
+    advanced.notify_all();
   }
+  advanced.notify_all();
+  for (std::thread &worker : workers)
+    worker.join();
+  if (error)
+    std::rethrow_exception(error);
 }
 
+/// Spreads a single file over several threads. The calling thread reads
+/// the file and copies the attributes of its path elements, a batch at a
+/// time, into a ring of slots. Workers tokenize, flatten and print each
+/// batch to memory, and a writer thread copies the batches to out in the
+/// order they were read. The reader waits once it is a ring ahead of the
+/// writer, so memory stays bounded however large the file is. As with -s,
+/// an error is thrown once every path before it has been printed.
+class PathPipeline : public TiXmlSaxHandler
+{
+  public: PathPipeline(unsigned int _workers, double _resolution, SvgReader::Flattening _flattening)
+          : workers(_workers), resolution(_resolution), flattening(_flattening),
+            ring(2 * _workers + 2), inPathTag(false)
+  {
+  }
+
+  public: void Run(const char *filename, OutputBuffer &out)
+  {
+    out << "=========\nFILE: " << filename << "\n";
+    SvgReader(resolution, flattening).Dump_header(out);
+    for (Slot &slot : ring)
+      slot.state = Slot::FREE;
+    filled = claimed = written = 0;
+    finished = stop = false;
+    current = 0;
+
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < workers; t++)
+      threads.push_back(std::thread([this]() { this->Work(); }));
+    threads.push_back(std::thread([this, &out]() { this->WriteOut(out); }));
+
+    std::exception_ptr readError;
+    try
+    {
+      SvgReader::Stream(filename, *this);
+    }
+    catch (...)
+    {
+      readError = std::current_exception();
+    }
+    // the paths read before an error still go out
+    if (current && !current->attribs.empty())
+      this->Submit();
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      finished = true;
+    }
+    ready.notify_all();
+    done.notify_all();
+    for (std::thread &thread : threads)
+      thread.join();
+    // an error in an earlier path wins over one further on in the file
+    if (error)
+      std::rethrow_exception(error);
+    if (readError)
+      std::rethrow_exception(readError);
+  }
+
+  public: virtual bool StartElement(const char *name)
+  {
+    inPathTag = strcasecmp(name, "path") == 0;
+    if (inPathTag)
+    {
+      if (!current && !this->Acquire())
+        return false;
+      for (int a = 0; a < ATTRIBUTES; a++)
+        values[a] = NONE;
+    }
+    return true;
+  }
+
+  public: virtual bool Attribute(const char *name, const char *value)
+  {
+    if (!inPathTag)
+      return true;
+    int a = this->AttributeIndex(name);
+    if (a >= 0)
+    {
+      values[a] = current->chars.size();
+      current->chars.append(value).push_back('\0');
+    }
+    return true;
+  }
+
+  public: virtual bool EndElement(const char *name)
+  {
+    inPathTag = false;
+    if (strcasecmp(name, "path") != 0 || !current)
+      return true;
+    current->attribs.insert(current->attribs.end(), values, values + ATTRIBUTES);
+    if (current->chars.size() >= BATCH_BYTES || current->attribs.size() >= BATCH_PATHS * ATTRIBUTES)
+      return this->Submit();
+    return true;
+  }
+
+  /// The attributes kept, in the order of NAMES
+  private: enum { ATTRIBUTES = 3 };
+  private: static int AttributeIndex(const char *name)
+  {
+    static const char *const NAMES[ATTRIBUTES] = { "id", "style", "d" };
+    for (int a = 0; a < ATTRIBUTES; a++)
+      if (strcasecmp(name, NAMES[a]) == 0)
+        return a;
+    return -1;
+  }
+  private: static SvgReader::NameKind AttributeKind(int a)
+  {
+    static const SvgReader::NameKind KINDS[ATTRIBUTES] =
+      { SvgReader::ID_NAME, SvgReader::STYLE_NAME, SvgReader::D_NAME };
+    return KINDS[a];
+  }
+
+  /// A batch hands over when it holds this much attribute text or this
+  /// many paths, whichever comes first
+  private: static const size_t BATCH_BYTES = 1 << 16;
+  private: static const size_t BATCH_PATHS = 256;
+  private: static const size_t NONE = (size_t) -1;
+
+  private: struct Slot
+  {
+    enum State { FREE, FILLED, DONE } state;
+    /// the attribute values of the batch, each followed by a null
+    std::string chars;
+    /// ATTRIBUTES offsets into chars per path, NONE where it has none
+    std::vector<size_t> attribs;
+    /// the batch as printed by a worker
+    OutputBuffer text;
+    std::exception_ptr error;
+  };
+
+  /// Waits for the next slot to be written out, then starts filling it.
+  /// Returns false if the pipeline has stopped
+  private: bool Acquire()
+  {
+    Slot &slot = ring[filled % ring.size()];
+    std::unique_lock<std::mutex> guard(lock);
+    freed.wait(guard, [&]() { return slot.state == Slot::FREE || stop; });
+    if (stop)
+      return false;
+    guard.unlock();
+    slot.chars.clear();
+    slot.attribs.clear();
+    current = &slot;
+    return true;
+  }
+
+  /// Hands the slot being filled to the workers
+  private: bool Submit()
+  {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      current->state = Slot::FILLED;
+      filled++;
+    }
+    current = 0;
+    ready.notify_all();
+    return !stop;
+  }
+
+  private: void Work()
+  {
+    SvgReader svg(resolution, flattening);
+    Path path;
+    while (true)
+    {
+      size_t batch;
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        ready.wait(guard, [&]() { return claimed < filled || finished || stop; });
+        if (stop || claimed == filled)
+          return;
+        batch = claimed++;
+      }
+      Slot &slot = ring[batch % ring.size()];
+      slot.text.Clear();
+      slot.error = std::exception_ptr();
+      try
+      {
+        for (size_t i = 0; i < slot.attribs.size(); i += ATTRIBUTES)
+        {
+          path.clear();
+          for (int a = 0; a < ATTRIBUTES; a++)
+            if (slot.attribs[i + a] != NONE)
+              svg.get_path_attrib(AttributeKind(a), &slot.chars[slot.attribs[i + a]], path);
+          svg.Dump_path(path, slot.text);
+        }
+      }
+      catch (...)
+      {
+        slot.error = std::current_exception();
+      }
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        slot.state = Slot::DONE;
+      }
+      done.notify_all();
+    }
+  }
+
+  private: void WriteOut(OutputBuffer &out)
+  {
+    while (true)
+    {
+      Slot &slot = ring[written % ring.size()];
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        done.wait(guard, [&]() { return slot.state == Slot::DONE || (finished && written == filled); });
+        if (slot.state != Slot::DONE)
+          return;
+      }
+      std::exception_ptr failure = slot.error;
+      try
+      {
+        out.Write(slot.text);
+      }
+      catch (...)
+      {
+        if (!failure)
+          failure = std::current_exception();
+      }
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        if (failure)
+        {
+          error = failure;
+          stop = true;
+        }
+        slot.state = Slot::FREE;
+        written++;
+      }
+      freed.notify_all();
+      if (failure)
+      {
+        ready.notify_all();
+        return;
+      }
+    }
+  }
+
+  private: unsigned int workers;
+  private: double resolution;
+  private: SvgReader::Flattening flattening;
+  private: std::vector<Slot> ring;
+
+  private: std::mutex lock;
+  /// a batch was filled, or the file has been read
+  private: std::condition_variable ready;
+  /// a batch was printed, or the file has been read
+  private: std::condition_variable done;
+  /// a batch was written out
+  private: std::condition_variable freed;
+  /// batches handed to the workers, taken by them and written out so far
+  private: size_t filled, claimed, written;
+  private: bool finished;
+  private: bool stop;
+  private: std::exception_ptr error;
+
+  /// what the reading thread is filling, or null
+  private: Slot *current;
+  private: bool inPathTag;
+  private: size_t values[ATTRIBUTES];
+};
+
 // ----------------------------------------------------------------------
 // main() for printing files named on the command line
 // ----------------------------------------------------------------------
+#ifndef SVG_NO_MAIN
 int main(int argc, char* argv[])
 {
-    std::vector<Path> paths;
-
-    for (int i=1; i<argc; i++)
+    // -s streams each file instead of loading its whole DOM
+    bool streaming = false;
+    // -r sets how closely curves are followed
+    double resolution = 0.1;
+    // -u samples curves evenly instead of adaptively
+    SvgReader::Flattening flattening = SvgReader::ADAPTIVE;
+    // -j processes that many files at once, or spreads a single file
+    // over that many threads
+    unsigned int threads = 1;
+    int first = 1;
+    for (; first < argc && argv[first][0] == '-'; first++)
     {
-      std::cout << "=========\nFILE: " << argv[i] << std::endl;
-      std::vector<Path> paths;
+      std::string option = argv[first];
+      if (option == "-s")
+      {
+        streaming = true;
+      }
+      else if (option == "-r" && first + 1 < argc && atof(argv[first + 1]) > 0)
+      {
+        resolution = atof(argv[++first]);
+      }
+      else if (option == "-u")
+      {
+        flattening = SvgReader::UNIFORM;
+      }
+      else if (option == "-j" && first + 1 < argc && atoi(argv[first + 1]) > 0)
+      {
+        threads = atoi(argv[++first]);
+      }
+      else
+      {
+        std::cerr << "usage: " << argv[0] << " [-s] [-u] [-r resolution] [-j threads] file.svg ..." << std::endl;
+        return 1;
+      }
+    }
+
+    // 0 if it can't be told
+    const unsigned int cores = std::thread::hardware_concurrency();
 
-      SvgReader svg;
-      svg.Parse(argv[i], paths);
-      svg.Dump_paths(paths);     
+    // everything goes to stdout through one buffer
+    OutputBuffer out(STDOUT_FILENO);
+    try
+    {
+      int count = argc - first;
+      if (threads > 1 && count > 1)
+      {
+        ProcessFiles(argv + first, count, std::min(threads, (unsigned int) count),
+                     resolution, flattening, streaming, out);
+      }
+      else if (threads > 1 && count == 1 && cores != 1)
+      {
+        // threads beyond the cores only hand batches back and forth, and
+        // the reading thread is busy too, so one worker fewer
+        if (cores > 1)
+          threads = std::min(threads, cores);
+        PathPipeline pipeline(threads - 1, resolution, flattening);
+        pipeline.Run(argv[first], out);
+      }
+      else
+      {
+        // a single core streams a single file as fast by itself, with the
+        // same output and as little memory as the pipeline
+        if (threads > 1)
+          streaming = true;
+        for (int i=first; i<argc; i++)
+        {
+          SvgReader svg(resolution, flattening);
+          ProcessFile(svg, argv[i], streaming, out);
+          out.Flush();
+        }
+      }
+      out.Flush();
+    }
+    catch (const std::exception &e)
+    {
+      // out is flushed on the way out, with what was printed before the error
+      std::cerr << argv[0] << ": " << e.what() << std::endl;
+      return 1;
     }
 
     return 0;
 }
-
+#endif
@@ -0,0 +1,2 @@
+g++ -std=c++11 -pthread alloc_test.cc tinystr.cpp tinyxml.cpp tinyxmlerror.cpp tinyxmlparser.cpp -o alloc_test && ./alloc_test &&
+g++ -std=c++11 -pthread path_test.cc tinystr.cpp tinyxml.cpp tinyxmlerror.cpp tinyxmlparser.cpp -o path_test && ./path_test
@@ -38,6 +38,10 @@ void TiXmlString::reserve (size_type cap)
 {
 	if (cap > capacity())
 	{
+		// Allocations come in multiples of 16 bytes, so take what is
+		// left over in the last one as well.
+		if (cap > SMALL_CAPACITY)
+			cap = ((sizeof(Rep) + cap + 15) & ~(size_type)15) - sizeof(Rep);
 		TiXmlString tmp;
 		tmp.init(length(), cap);
 		memcpy(tmp.start(), data(), length());
@@ -48,6 +52,10 @@ void TiXmlString::reserve (size_type cap)
 
 TiXmlString& TiXmlString::assign(const char* str, size_type len)
 {
+	// Nothing to write, and nullrep_ is shared by every empty string on
+	// every thread, so it must never be written to.
+	if (len == 0 && rep_ == &nullrep_)
+		return *this;
 	size_type cap = capacity();
 	if (len > cap || cap > 3*(len + 8))
 	{
@@ -67,6 +75,9 @@ TiXmlString& TiXmlString::assign(const char* str, size_type len)
 
 TiXmlString& TiXmlString::append(const char* str, size_type len)
 {
+	// As in assign(), an empty string may be the shared nullrep_.
+	if (len == 0)
+		return *this;
 	size_type newsize = length() + len;
 	if (newsize > capacity())
 	{
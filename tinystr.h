@@ -45,12 +45,19 @@ distribution.
 #endif
 
 
+// Memory for the text of strings: from the heap, or from the arena of the
+// document being parsed. See TiXmlArena in tinyxml.h.
+void* TiXmlAllocate( size_t size );
+void TiXmlDeallocate( void* p );
+
+
 /*
    TiXmlString is an emulation of a subset of the std::string template.
    Its purpose is to allow compiling TinyXML on compilers with no or poor STL support.
    Only the member functions relevant to the TinyXML project have been implemented.
    The buffer allocation is made by a simplistic power of 2 like mechanism : if we increase
    a string and there's no more room, we allocate a buffer twice as big as we need.
+   Strings of up to SMALL_CAPACITY characters are kept inside the object, and allocate nothing.
 */
 class TiXmlString
 {
@@ -196,11 +203,23 @@ class TiXmlString
 
 	void swap (TiXmlString& other)
 	{
-		Rep* r = rep_;
-		rep_ = other.rep_;
-		other.rep_ = r;
+		if (!is_small() && !other.is_small())
+		{
+			Rep* r = rep_;
+			rep_ = other.rep_;
+			other.rep_ = r;
+			return;
+		}
+		// An inline rep can't change hands, only be copied.
+		TiXmlString tmp;
+		tmp.take(*this);
+		take(other);
+		other.take(tmp);
 	}
 
+	// Longest string held inside the object.
+	enum { SMALL_CAPACITY = 15 };
+
   private:
 
 	void init(size_type sz) { init(sz, sz); }
@@ -214,18 +233,46 @@ class TiXmlString
 		char str[1];
 	};
 
+	// Laid out as a Rep, with room for SMALL_CAPACITY characters and the null.
+	struct SmallRep
+	{
+		size_type size, capacity;
+		char str[SMALL_CAPACITY + 1];
+	};
+
+	Rep* small_rep() const { return reinterpret_cast<Rep*>( const_cast<SmallRep*>( &small_ ) ); }
+	bool is_small() const { return rep_ == small_rep(); }
+
+	// Moves the text of other, which is left empty, into this empty string.
+	void take(TiXmlString& other)
+	{
+		if (other.is_small())
+		{
+			init(other.length(), SMALL_CAPACITY);
+			memcpy(start(), other.data(), length());
+		}
+		else
+		{
+			rep_ = other.rep_;
+		}
+		other.rep_ = &nullrep_;
+	}
+
 	void init(size_type sz, size_type cap)
 	{
-		if (cap)
+		if (cap && cap <= SMALL_CAPACITY)
+		{
+			rep_ = small_rep();
+			rep_->str[ rep_->size = sz ] = '\0';
+			rep_->capacity = SMALL_CAPACITY;
+		}
+		else if (cap)
 		{
 			// Lee: the original form:
 			//	rep_ = static_cast<Rep*>(operator new(sizeof(Rep) + cap));
-			// doesn't work in some cases of new being overloaded. Switching
-			// to the normal allocation, although use an 'int' for systems
-			// that are overly picky about structure alignment.
-			const size_type bytesNeeded = sizeof(Rep) + cap;
-			const size_type intsNeeded = ( bytesNeeded + sizeof(int) - 1 ) / sizeof( int ); 
-			rep_ = reinterpret_cast<Rep*>( new int[ intsNeeded ] );
+			// doesn't work in some cases of new being overloaded. TiXmlAllocate
+			// returns memory aligned for any type, and can come from an arena.
+			rep_ = static_cast<Rep*>( TiXmlAllocate( sizeof(Rep) + cap ) );
 
 			rep_->str[ rep_->size = sz ] = '\0';
 			rep_->capacity = cap;
@@ -238,15 +285,14 @@ class TiXmlString
 
 	void quit()
 	{
-		if (rep_ != &nullrep_)
+		if (rep_ != &nullrep_ && !is_small())
 		{
-			// The rep_ is really an array of ints. (see the allocator, above).
-			// Cast it back before delete, so the compiler won't incorrectly call destructors.
-			delete [] ( reinterpret_cast<int*>( rep_ ) );
+			TiXmlDeallocate( rep_ );
 		}
 	}
 
 	Rep * rep_;
+	SmallRep small_;
 	static Rep nullrep_;
 
 } ;
@@ -31,6 +31,11 @@ distribution.
 
 #include "tinyxml.h"
 
+#ifdef TIXML_USE_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 FILE* TiXmlFOpen( const char* filename, const char* mode );
 
 bool TiXmlBase::condenseWhiteSpace = true;
@@ -49,6 +54,227 @@ FILE* TiXmlFOpen( const char* filename, const char* mode )
 	#endif
 }
 
+// Each thread parses into its own document, so each has its own current arena.
+#if __cplusplus >= 201103L
+	#define TIXML_THREAD_LOCAL thread_local
+#elif defined( __GNUC__ )
+	#define TIXML_THREAD_LOCAL __thread
+#elif defined( _MSC_VER )
+	#define TIXML_THREAD_LOCAL __declspec( thread )
+#else
+	#define TIXML_THREAD_LOCAL
+#endif
+
+static TIXML_THREAD_LOCAL TiXmlArena* currentArena = 0;
+
+// Every block from TiXmlAllocate starts with the arena it came from, or null
+// for the heap, padded so that what follows is aligned for any type.
+union TiXmlBlockHeader
+{
+	TiXmlArena* arena;
+	long double alignLongDouble;
+	void* alignPointer;
+};
+
+static const size_t TIXML_ARENA_FIRST_CHUNK = 64 * 1024;
+static const size_t TIXML_ARENA_LARGEST_CHUNK = 4 * 1024 * 1024;
+
+
+TiXmlArena::TiXmlArena() : chunks( 0 ), cursor( 0 ), end( 0 ), chunkSize( TIXML_ARENA_FIRST_CHUNK )
+{
+}
+
+
+TiXmlArena::~TiXmlArena()
+{
+	Reset();
+}
+
+
+void* TiXmlArena::Allocate( size_t size )
+{
+	const size_t align = sizeof( TiXmlBlockHeader );
+	size = ( size + align - 1 ) / align * align;
+	if ( size > (size_t)( end - cursor ) )
+	{
+		// Big blocks get a chunk of their own, so the rest of the current
+		// chunk isn't wasted.
+		size_t length = chunkSize;
+		if ( size > chunkSize / 4 )
+			length = size;
+		else if ( chunkSize < TIXML_ARENA_LARGEST_CHUNK )
+			chunkSize *= 2;
+
+		// The chunk header is padded like a block header to keep alignment.
+		char* raw = static_cast<char*>( ::operator new( align + length ) );
+		Chunk* chunk = reinterpret_cast<Chunk*>( raw );
+		if ( length == size && chunks )
+		{
+			// keep filling the current chunk afterwards
+			chunk->next = chunks->next;
+			chunks->next = chunk;
+			return raw + align;
+		}
+		chunk->next = chunks;
+		chunks = chunk;
+		cursor = raw + align;
+		end = cursor + length;
+	}
+	void* p = cursor;
+	cursor += size;
+	return p;
+}
+
+
+void TiXmlArena::Reset()
+{
+	while ( chunks )
+	{
+		Chunk* next = chunks->next;
+		::operator delete( chunks );
+		chunks = next;
+	}
+	cursor = end = 0;
+	chunkSize = TIXML_ARENA_FIRST_CHUNK;
+}
+
+
+/*static*/ TiXmlArena* TiXmlArena::Current()
+{
+	return currentArena;
+}
+
+
+/*static*/ TiXmlArena* TiXmlArena::MakeCurrent( TiXmlArena* arena )
+{
+	TiXmlArena* previous = currentArena;
+	currentArena = arena;
+	return previous;
+}
+
+
+void* TiXmlAllocate( size_t size )
+{
+	TiXmlArena* arena = currentArena;
+	TiXmlBlockHeader* header;
+	if ( arena )
+		header = static_cast<TiXmlBlockHeader*>( arena->Allocate( sizeof( TiXmlBlockHeader ) + size ) );
+	else
+		header = static_cast<TiXmlBlockHeader*>( ::operator new( sizeof( TiXmlBlockHeader ) + size ) );
+	header->arena = arena;
+	return header + 1;
+}
+
+
+void TiXmlDeallocate( void* p )
+{
+	if ( !p )
+		return;
+	TiXmlBlockHeader* header = static_cast<TiXmlBlockHeader*>( p ) - 1;
+	// Arena memory goes back with the whole arena.
+	if ( !header->arena )
+		::operator delete( header );
+}
+
+
+TiXmlAtomTable::TiXmlAtomTable()
+{
+	entries = 0;
+	count = 1;
+	capacity = 0;
+	slots = 0;
+	slotCount = 0;
+}
+
+
+TiXmlAtomTable::~TiXmlAtomTable()
+{
+	for ( int i=1; i<count; ++i )
+		delete [] entries[i].name;
+	delete [] entries;
+	delete [] slots;
+}
+
+
+/*static*/ unsigned TiXmlAtomTable::Hash( const char* name, size_t length )
+{
+	// FNV-1a: names are short, so anything cleverer doesn't pay.
+	unsigned hash = 2166136261u;
+	for ( size_t i=0; i<length; ++i )
+		hash = ( hash ^ (unsigned char) name[i] ) * 16777619u;
+	return hash;
+}
+
+
+int* TiXmlAtomTable::Slot( const char* name, size_t length, unsigned hash ) const
+{
+	int mask = slotCount - 1;
+	for ( int i = hash & mask; ; i = ( i+1 ) & mask )
+	{
+		int atom = slots[i];
+		if ( !atom )
+			return &slots[i];
+		const Entry& entry = entries[atom];
+		if ( entry.hash == hash && entry.length == length && memcmp( entry.name, name, length ) == 0 )
+			return &slots[i];
+	}
+}
+
+
+int TiXmlAtomTable::Find( const char* name, size_t length ) const
+{
+	if ( !slots )
+		return 0;
+	return *Slot( name, length, Hash( name, length ) );
+}
+
+
+int TiXmlAtomTable::Intern( const char* name, size_t length )
+{
+	unsigned hash = Hash( name, length );
+	if ( slots )
+	{
+		int atom = *Slot( name, length, hash );
+		if ( atom )
+			return atom;
+	}
+
+	// A new name. This is plain heap memory, whatever arena is current.
+	if ( count >= capacity )
+	{
+		capacity = capacity ? capacity*2 : 64;
+		Entry* grown = new Entry[ capacity ];
+		if ( entries )
+			memcpy( grown, entries, count * sizeof( Entry ) );
+		delete [] entries;
+		entries = grown;
+	}
+	int atom = count++;
+	Entry& entry = entries[atom];
+	entry.name = new char[ length+1 ];
+	memcpy( entry.name, name, length );
+	entry.name[length] = 0;
+	entry.length = length;
+	entry.hash = hash;
+
+	if ( count*2 > slotCount )
+	{
+		// Rehash into twice the slots.
+		delete [] slots;
+		slotCount = slotCount ? slotCount*2 : 128;
+		slots = new int[ slotCount ];
+		memset( slots, 0, slotCount * sizeof( int ) );
+		for ( int i=1; i<count; ++i )
+			*Slot( entries[i].name, entries[i].length, entries[i].hash ) = i;
+	}
+	else
+	{
+		*Slot( name, length, hash ) = atom;
+	}
+	return atom;
+}
+
+
 void TiXmlBase::EncodeString( const TIXML_STRING& str, TIXML_STRING* outString )
 {
 	int i=0;
@@ -132,11 +358,298 @@ void TiXmlBase::EncodeString( const TIXML_STRING& str, TIXML_STRING* outString )
 	}
 }
 
+// Shortest round trip output, Grisu2 (Florian Loitsch, "Printing
+// Floating-Point Numbers Quickly and Accurately with Integers", 2010.)
+// A double is scaled by a cached power of ten into a 64 bit fixed point
+// number, then digits are produced until the result is closer to the
+// value than to either neighbouring double.
+
+// A floating point number f * 2^e with a 64 bit significand.
+struct TiXmlDiyFp
+{
+	unsigned long long f;
+	int e;
+};
+
+static TiXmlDiyFp DiyFpMultiply( const TiXmlDiyFp& a, const TiXmlDiyFp& b )
+{
+	// The upper 64 bits of the 128 bit product, rounded.
+	const unsigned long long M32 = 0xFFFFFFFFULL;
+	unsigned long long ah = a.f >> 32, al = a.f & M32;
+	unsigned long long bh = b.f >> 32, bl = b.f & M32;
+	unsigned long long hh = ah * bh, hl = ah * bl, lh = al * bh, ll = al * bl;
+	unsigned long long mid = ( ll >> 32 ) + ( hl & M32 ) + ( lh & M32 ) + ( 1ULL << 31 );
+	TiXmlDiyFp r;
+	r.f = hh + ( hl >> 32 ) + ( lh >> 32 ) + ( mid >> 32 );
+	r.e = a.e + b.e + 64;
+	return r;
+}
+
+static TiXmlDiyFp DiyFpNormalize( TiXmlDiyFp x )
+{
+	#if defined( __GNUC__ )
+		int shift = __builtin_clzll( x.f );
+		x.f <<= shift;
+		x.e -= shift;
+	#else
+		while ( !( x.f & ( 1ULL << 63 ) ) )
+		{
+			x.f <<= 1;
+			--x.e;
+		}
+	#endif
+	return x;
+}
+
+// 10^k for k = -348, -340, ..., 340, normalized so that the top bit is set.
+static TiXmlDiyFp DiyFpCachedPower( int index )
+{
+	static const unsigned long long significands[] =
+	{
+		0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL, 0xcf42894a5dce35eaULL,
+		0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL, 0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL,
+		0xbe5691ef416bd60cULL, 0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+		0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL, 0xc21094364dfb5637ULL,
+		0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL, 0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL,
+		0xb23867fb2a35b28eULL, 0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+		0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL, 0xb5b5ada8aaff80b8ULL,
+		0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL, 0x964e858c91ba2655ULL, 0xdff9772470297ebdULL,
+		0xa6dfbd9fb8e5b88fULL, 0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+		0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL, 0xaa242499697392d3ULL,
+		0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL, 0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL,
+		0x9c40000000000000ULL, 0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+		0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL, 0x9f4f2726179a2245ULL,
+		0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL, 0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL,
+		0x924d692ca61be758ULL, 0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+		0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL, 0x952ab45cfa97a0b3ULL,
+		0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL, 0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL,
+		0x88fcf317f22241e2ULL, 0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+		0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL, 0x8bab8eefb6409c1aULL,
+		0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL, 0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL,
+		0x80444b5e7aa7cf85ULL, 0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+		0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL,
+	};
+	static const short exponents[] =
+	{
+		-1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+		-901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+		-582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+		-263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+		56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+		375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+		694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+		1013, 1039, 1066,
+	};
+	TiXmlDiyFp r;
+	r.f = significands[ index ];
+	r.e = exponents[ index ];
+	return r;
+}
+
+// Backs the last digit off towards w while that stays inside the range.
+static void GrisuRound( char* buffer, int length, unsigned long long delta, unsigned long long rest,
+						unsigned long long tenKappa, unsigned long long distance )
+{
+	while (    rest < distance && delta - rest >= tenKappa
+			&& ( rest + tenKappa < distance || distance - rest > rest + tenKappa - distance ) )
+	{
+		--buffer[ length - 1 ];
+		rest += tenKappa;
+	}
+}
+
+// Writes the digits of the number in [high - delta, high] closest to w and
+// with as few digits as possible. Adds the scale of the last digit to k.
+static int GrisuDigits( const TiXmlDiyFp& w, const TiXmlDiyFp& high, unsigned long long delta, char* buffer, int* k )
+{
+	static const unsigned long long powersOfTen[] =
+	{
+		1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+		100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+		10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+		100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+	};
+	const int shift = -high.e;
+	const unsigned long long one = 1ULL << shift;
+	const unsigned long long distance = high.f - w.f;
+	unsigned int integral = (unsigned int)( high.f >> shift );
+	unsigned long long fraction = high.f & ( one - 1 );
+	int length = 0;
+
+	// the integral part fits in 32 bits, and 32 bit division is much cheaper
+	static const unsigned int smallPowersOfTen[] =
+	{
+		1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+	};
+	int kappa = 1;
+	while ( kappa < 10 && integral >= smallPowersOfTen[ kappa ] )
+		++kappa;
+	while ( kappa > 0 )
+	{
+		unsigned int digit = integral / smallPowersOfTen[ kappa - 1 ];
+		integral %= smallPowersOfTen[ kappa - 1 ];
+		if ( digit || length )
+			buffer[ length++ ] = (char)( '0' + digit );
+		--kappa;
+		unsigned long long rest = ( (unsigned long long) integral << shift ) + fraction;
+		if ( rest <= delta )
+		{
+			*k += kappa;
+			GrisuRound( buffer, length, delta, rest, powersOfTen[ kappa ] << shift, distance );
+			return length;
+		}
+	}
+	for ( ;; )
+	{
+		fraction *= 10;
+		delta *= 10;
+		char digit = (char)( fraction >> shift );
+		if ( digit || length )
+			buffer[ length++ ] = (char)( '0' + digit );
+		fraction &= one - 1;
+		--kappa;
+		if ( fraction < delta )
+		{
+			*k += kappa;
+			GrisuRound( buffer, length, delta, fraction, one, -kappa < 20 ? distance * powersOfTen[ -kappa ] : 0 );
+			return length;
+		}
+	}
+}
+
+/*static*/ char* TiXmlBase::WriteDouble( double value, char* buffer )
+{
+	unsigned long long bits;
+	memcpy( &bits, &value, sizeof( bits ) );
+	int biased = (int)( ( bits >> 52 ) & 0x7FF );
+	unsigned long long significand = bits & ( ( 1ULL << 52 ) - 1 );
+
+	if ( biased == 0x7FF && significand )
+	{
+		memcpy( buffer, "NaN", 4 );
+		return buffer + 3;
+	}
+	if ( bits >> 63 )
+		*buffer++ = '-';
+	if ( biased == 0x7FF )
+	{
+		memcpy( buffer, "Infinity", 9 );
+		return buffer + 8;
+	}
+	if ( biased == 0 && significand == 0 )
+	{
+		buffer[ 0 ] = '0';
+		buffer[ 1 ] = 0;
+		return buffer + 1;
+	}
+
+	// value = v.f * 2^v.e, and halfway to its neighbours on either side
+	TiXmlDiyFp v;
+	if ( biased )
+	{
+		v.f = significand + ( 1ULL << 52 );
+		v.e = biased - 1075;
+	}
+	else
+	{
+		v.f = significand;
+		v.e = -1074;
+	}
+	TiXmlDiyFp high;
+	high.f = ( v.f << 1 ) + 1;
+	high.e = v.e - 1;
+	high = DiyFpNormalize( high );
+	TiXmlDiyFp low;
+	if ( v.f == ( 1ULL << 52 ) && biased > 1 )
+	{
+		// the gap below a power of two is half the size
+		low.f = ( v.f << 2 ) - 1;
+		low.e = v.e - 2;
+	}
+	else
+	{
+		low.f = ( v.f << 1 ) - 1;
+		low.e = v.e - 1;
+	}
+	low.f <<= low.e - high.e;
+	low.e = high.e;
+
+	// Pick the power of ten that brings high's exponent into [-60, -32].
+	double dk = ( -61 - high.e ) * 0.30102999566398114 + 347;
+	int k = (int) dk;
+	if ( dk - k > 0.0 )
+		++k;
+	int index = ( k >> 3 ) + 1;
+	k = -( -348 + index * 8 );
+	TiXmlDiyFp c = DiyFpCachedPower( index );
+
+	TiXmlDiyFp w = DiyFpMultiply( DiyFpNormalize( v ), c );
+	high = DiyFpMultiply( high, c );
+	low = DiyFpMultiply( low, c );
+	// stay inside the interval, whichever way the products were rounded
+	++low.f;
+	--high.f;
+	char digits[ 20 ];
+	int length = GrisuDigits( w, high, high.f - low.f, digits, &k );
+
+	// Lay the digits out the way ECMAScript's Number.prototype.toString does:
+	// plain decimals from 1e-6 up to 1e21, exponents outside that.
+	int point = length + k;
+	char* p = buffer;
+	if ( length <= point && point <= 21 )
+	{
+		memcpy( p, digits, length );
+		p += length;
+		for ( int i = length; i < point; ++i )
+			*p++ = '0';
+	}
+	else if ( 0 < point && point <= 21 )
+	{
+		memcpy( p, digits, point );
+		p += point;
+		*p++ = '.';
+		memcpy( p, digits + point, length - point );
+		p += length - point;
+	}
+	else if ( -6 < point && point <= 0 )
+	{
+		*p++ = '0';
+		*p++ = '.';
+		for ( int i = point; i < 0; ++i )
+			*p++ = '0';
+		memcpy( p, digits, length );
+		p += length;
+	}
+	else
+	{
+		*p++ = digits[ 0 ];
+		if ( length > 1 )
+		{
+			*p++ = '.';
+			memcpy( p, digits + 1, length - 1 );
+			p += length - 1;
+		}
+		int exponent = point - 1;
+		*p++ = 'e';
+		*p++ = exponent < 0 ? '-' : '+';
+		if ( exponent < 0 )
+			exponent = -exponent;
+		if ( exponent >= 100 )
+			*p++ = (char)( '0' + exponent / 100 );
+		if ( exponent >= 10 )
+			*p++ = (char)( '0' + exponent / 10 % 10 );
+		*p++ = (char)( '0' + exponent % 10 );
+	}
+	*p = 0;
+	return p;
+}
+
 
 TiXmlNode::TiXmlNode( NodeType _type ) : TiXmlBase()
 {
 	parent = 0;
 	type = _type;
+	atom = 0;
 	firstChild = 0;
 	lastChild = 0;
 	prev = 0;
@@ -914,6 +1427,14 @@ TiXmlDocument::TiXmlDocument() : TiXmlNode( TiXmlNode::TINYXML_DOCUMENT )
 {
 	tabsize = 4;
 	useMicrosoftBOM = false;
+	memoryMapped = false;
+	arenaAllocated = false;
+	inSitu = false;
+	parsingInSitu = false;
+	trackLocations = true;
+	filterMode = TIXML_FILTER_DENY;
+	inSituBuffer = 0;
+	inSituMapLength = 0;
 	ClearError();
 }
 
@@ -921,6 +1442,14 @@ TiXmlDocument::TiXmlDocument( const char * documentName ) : TiXmlNode( TiXmlNode
 {
 	tabsize = 4;
 	useMicrosoftBOM = false;
+	memoryMapped = false;
+	arenaAllocated = false;
+	inSitu = false;
+	parsingInSitu = false;
+	trackLocations = true;
+	filterMode = TIXML_FILTER_DENY;
+	inSituBuffer = 0;
+	inSituMapLength = 0;
 	value = documentName;
 	ClearError();
 }
@@ -931,6 +1460,14 @@ TiXmlDocument::TiXmlDocument( const std::string& documentName ) : TiXmlNode( TiX
 {
 	tabsize = 4;
 	useMicrosoftBOM = false;
+	memoryMapped = false;
+	arenaAllocated = false;
+	inSitu = false;
+	parsingInSitu = false;
+	trackLocations = true;
+	filterMode = TIXML_FILTER_DENY;
+	inSituBuffer = 0;
+	inSituMapLength = 0;
     value = documentName;
 	ClearError();
 }
@@ -939,10 +1476,19 @@ TiXmlDocument::TiXmlDocument( const std::string& documentName ) : TiXmlNode( TiX
 
 TiXmlDocument::TiXmlDocument( const TiXmlDocument& copy ) : TiXmlNode( TiXmlNode::TINYXML_DOCUMENT )
 {
+	parsingInSitu = false;
+	inSituBuffer = 0;
+	inSituMapLength = 0;
 	copy.CopyTo( this );
 }
 
 
+TiXmlDocument::~TiXmlDocument()
+{
+	Clear();
+}
+
+
 TiXmlDocument& TiXmlDocument::operator=( const TiXmlDocument& copy )
 {
 	Clear();
@@ -951,6 +1497,15 @@ TiXmlDocument& TiXmlDocument::operator=( const TiXmlDocument& copy )
 }
 
 
+void TiXmlDocument::Clear()
+{
+	// The nodes may live in the arena, or point into the buffer, so they go first.
+	TiXmlNode::Clear();
+	ReleaseInSituBuffer();
+	arena.Reset();
+}
+
+
 bool TiXmlDocument::LoadFile( TiXmlEncoding encoding )
 {
 	return LoadFile( Value(), encoding );
@@ -984,6 +1539,40 @@ bool TiXmlDocument::LoadFile( const char* _filename, TiXmlEncoding encoding )
 }
 
 bool TiXmlDocument::LoadFile( FILE* file, TiXmlEncoding encoding )
+{
+	return Load( file, 0, encoding );
+}
+
+
+bool TiXmlDocument::SaxLoadFile( const char* _filename, TiXmlSaxHandler* handler, TiXmlEncoding encoding )
+{
+	TIXML_STRING filename( _filename );
+	value = filename;
+
+	FILE* file = TiXmlFOpen( value.c_str (), "rb" );
+
+	if ( file )
+	{
+		bool result = SaxLoadFile( file, handler, encoding );
+		fclose( file );
+		return result;
+	}
+	else
+	{
+		SetError( TIXML_ERROR_OPENING_FILE, 0, 0, TIXML_ENCODING_UNKNOWN );
+		return false;
+	}
+}
+
+
+bool TiXmlDocument::SaxLoadFile( FILE* file, TiXmlSaxHandler* handler, TiXmlEncoding encoding )
+{
+	assert( handler );
+	return Load( file, handler, encoding );
+}
+
+
+bool TiXmlDocument::Load( FILE* file, TiXmlSaxHandler* handler, TiXmlEncoding encoding )
 {
 	if ( !file ) 
 	{
@@ -1029,6 +1618,30 @@ bool TiXmlDocument::LoadFile( FILE* file, TiXmlEncoding encoding )
 	}
 	*/
 
+	#ifdef TIXML_USE_MMAP
+	if ( memoryMapped )
+	{
+		size_t mapLength = 0;
+		char* buf = MapFile( file, length, &mapLength );
+		if ( buf )
+		{
+			// Nothing before the first CR is written to, so files with Unix
+			// line endings stay shared with the page cache.
+			NormalizeNewLines( buf, buf+length );
+
+			if ( ParseLoaded( buf, handler, encoding ) )
+			{
+				inSituBuffer = buf;
+				inSituMapLength = mapLength;
+			}
+			else
+				munmap( buf, mapLength );
+			return !Error();
+		}
+		// Not something we can map (a pipe, for instance.) Read it instead.
+	}
+	#endif
+
 	char* buf = new char[ length+1 ];
 	buf[0] = 0;
 
@@ -1038,7 +1651,49 @@ bool TiXmlDocument::LoadFile( FILE* file, TiXmlEncoding encoding )
 		return false;
 	}
 
-	// Process the buffer in place to normalize new lines. (See comment above.)
+	buf[length] = 0;
+	NormalizeNewLines( buf, buf+length );
+
+	if ( ParseLoaded( buf, handler, encoding ) )
+		inSituBuffer = buf;
+	else
+		delete [] buf;
+	return !Error();
+}
+
+
+bool TiXmlDocument::ParseLoaded( char* buf, TiXmlSaxHandler* handler, TiXmlEncoding encoding )
+{
+	// Parse() and SaxParse() clear the flag as they take it, so that it
+	// never outlives this call, even if the handler throws.
+	parsingInSitu = inSitu;
+	if ( handler )
+		SaxParse( buf, handler, encoding );
+	else
+		Parse( buf, 0, encoding );
+	// A SAX handler is done with the attributes by now.
+	return inSitu && !handler;
+}
+
+
+void TiXmlDocument::ReleaseInSituBuffer()
+{
+	if ( !inSituBuffer )
+		return;
+	#ifdef TIXML_USE_MMAP
+	if ( inSituMapLength )
+		munmap( inSituBuffer, inSituMapLength );
+	else
+	#endif
+		delete [] inSituBuffer;
+	inSituBuffer = 0;
+	inSituMapLength = 0;
+}
+
+
+/*static*/ void TiXmlDocument::NormalizeNewLines( char* buf, const char* end )
+{
+	// Process the buffer in place to normalize new lines. (See comment in LoadFile.)
 	// Copies from the 'p' to 'q' pointer, where p can advance faster if
 	// a newline-carriage return is hit.
 	//
@@ -1049,36 +1704,72 @@ bool TiXmlDocument::LoadFile( FILE* file, TiXmlEncoding encoding )
     //		* CR+LF: DEC RT-11 and most other early non-Unix, non-IBM OSes, CP/M, MP/M, DOS, OS/2, Microsoft Windows, Symbian OS
     //		* CR:    Commodore 8-bit machines, Apple II family, Mac OS up to version 9 and OS-9
 
-	const char* p = buf;	// the read head
-	char* q = buf;			// the write head
 	const char CR = 0x0d;
 	const char LF = 0x0a;
 
-	buf[length] = 0;
-	while( *p ) {
-		assert( p < (buf+length) );
-		assert( q <= (buf+length) );
-		assert( q <= p );
-
-		if ( *p == CR ) {
-			*q++ = LF;
-			p++;
-			if ( *p == LF ) {		// check for CR+LF (and skip LF)
-				p++;
-			}
-		}
-		else {
-			*q++ = *p++;
+	assert( *end == 0 );
+
+	// Nothing before the first CR changes, and after it only the runs
+	// between CRs move. memchr() and memmove() go a block at a time.
+	char* p = (char*) memchr( buf, CR, end - buf );	// the read head, at a CR
+	char* q = p;									// the write head
+	while ( p )
+	{
+		*q++ = LF;
+		++p;
+		if ( *p == LF ) {		// check for CR+LF (and skip LF)
+			++p;
 		}
+		char* next = (char*) memchr( p, CR, end - p );
+		size_t run = ( next ? next : end ) - p;
+		memmove( q, p, run );
+		q += run;
+		p = next;
 	}
-	assert( q <= (buf+length) );
-	*q = 0;
+	if ( q )
+	{
+		assert( q <= end );
+		*q = 0;
+	}
+}
 
-	Parse( buf, 0, encoding );
 
-	delete [] buf;
-	return !Error();
+#ifdef TIXML_USE_MMAP
+/*static*/ char* TiXmlDocument::MapFile( FILE* file, long length, size_t* mapLength )
+{
+	int fd = fileno( file );
+	if ( fd < 0 )
+		return 0;
+
+	// The parser needs a null terminator. Reserve an anonymous region one
+	// byte longer than the file, rounded up to whole pages, and map the file
+	// over the front of it. The byte after the file is then either the zero
+	// fill of the file's last page or the untouched anonymous page after it.
+	long pageSize = sysconf( _SC_PAGESIZE );
+	if ( pageSize <= 0 )
+		return 0;
+	size_t regionLength = ( (size_t)length + 1 + pageSize - 1 ) / pageSize * pageSize;
+
+	void* region = mmap( 0, regionLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+	if ( region == MAP_FAILED )
+		return 0;
+
+	int flags = MAP_PRIVATE | MAP_FIXED;
+	#ifdef MAP_POPULATE
+	flags |= MAP_POPULATE;		// fault the whole file in up front
+	#endif
+	void* data = mmap( region, length, PROT_READ | PROT_WRITE, flags, fd, 0 );
+	if ( data == MAP_FAILED )
+	{
+		munmap( region, regionLength );
+		return 0;
+	}
+	madvise( data, length, MADV_SEQUENTIAL );
+
+	*mapLength = regionLength;
+	return (char*) data;
 }
+#endif
 
 
 bool TiXmlDocument::SaveFile( const char * filename ) const
@@ -1122,6 +1813,12 @@ void TiXmlDocument::CopyTo( TiXmlDocument* target ) const
 	target->tabsize = tabsize;
 	target->errorLocation = errorLocation;
 	target->useMicrosoftBOM = useMicrosoftBOM;
+	target->memoryMapped = memoryMapped;
+	target->arenaAllocated = arenaAllocated;
+	target->inSitu = inSitu;
+	target->trackLocations = trackLocations;
+	target->filterNames = filterNames;
+	target->filterMode = filterMode;
 
 	TiXmlNode* node = 0;
 	for ( node = firstChild; node; node = node->NextSibling() )
@@ -1171,7 +1868,7 @@ const TiXmlAttribute* TiXmlAttribute::Next() const
 {
 	// We are using knowledge of the sentinel. The sentinel
 	// have a value or name.
-	if ( next->value.empty() && next->name.empty() )
+	if ( !*next->Value() && !*next->Name() )
 		return 0;
 	return next;
 }
@@ -1191,7 +1888,7 @@ const TiXmlAttribute* TiXmlAttribute::Previous() const
 {
 	// We are using knowledge of the sentinel. The sentinel
 	// have a value or name.
-	if ( prev->value.empty() && prev->name.empty() )
+	if ( !*prev->Value() && !*prev->Name() )
 		return 0;
 	return prev;
 }
@@ -1211,10 +1908,13 @@ void TiXmlAttribute::Print( FILE* cfile, int /*depth*/, TIXML_STRING* str ) cons
 {
 	TIXML_STRING n, v;
 
-	EncodeString( name, &n );
-	EncodeString( value, &v );
+	// In situ text is encoded from a copy made here: NameTStr() and
+	// ValueTStr() would keep theirs in the attribute, and printing must not
+	// write to what other threads may be reading.
+	EncodeString( inSituName ? TIXML_STRING( inSituName ) : name, &n );
+	EncodeString( inSituValue ? TIXML_STRING( inSituValue ) : value, &v );
 
-	if (value.find ('\"') == TIXML_STRING::npos) {
+	if ( !strchr( Value(), '\"' ) ) {
 		if ( cfile ) {
 			fprintf (cfile, "%s=\"%s\"", n.c_str(), v.c_str() );
 		}
@@ -1233,20 +1933,68 @@ void TiXmlAttribute::Print( FILE* cfile, int /*depth*/, TIXML_STRING* str ) cons
 }
 
 
+const TIXML_STRING& TiXmlAttribute::NameTStr() const
+{
+	if ( inSituName )
+	{
+		name = inSituName;
+		inSituName = 0;
+	}
+	return name;
+}
+
+
+const TIXML_STRING& TiXmlAttribute::ValueTStr() const
+{
+	if ( inSituValue )
+	{
+		value = inSituValue;
+		inSituValue = 0;
+	}
+	return value;
+}
+
+
 int TiXmlAttribute::QueryIntValue( int* ival ) const
 {
-	if ( TIXML_SSCANF( value.c_str(), "%d", ival ) == 1 )
+	if ( TIXML_SSCANF( Value(), "%d", ival ) == 1 )
 		return TIXML_SUCCESS;
 	return TIXML_WRONG_TYPE;
 }
 
 int TiXmlAttribute::QueryDoubleValue( double* dval ) const
 {
-	if ( TIXML_SSCANF( value.c_str(), "%lf", dval ) == 1 )
+	const char* p = Value();
+	while ( IsWhiteSpace( *p ) )
+		++p;
+	if ( ReadDouble( p, dval ) )
+		return TIXML_SUCCESS;
+	// Not a plain decimal number. Let the C library try: it knows inf, nan and hex.
+	if ( TIXML_SSCANF( Value(), "%lf", dval ) == 1 )
 		return TIXML_SUCCESS;
 	return TIXML_WRONG_TYPE;
 }
 
+void TiXmlAttribute::SetName( const char* _name )
+{
+	// The set indexes by name, so it has to hear about the change.
+	TiXmlAttributeSet* owner = set;
+	if ( owner )
+		owner->Unindex( this );
+	name = _name;
+	inSituName = 0;
+	atom = 0;
+	if ( owner )
+		owner->Index( this );
+}
+
+#ifdef TIXML_USE_STL
+void TiXmlAttribute::SetName( const std::string& _name )
+{
+	SetName( _name.c_str() );
+}
+#endif
+
 void TiXmlAttribute::SetIntValue( int _value )
 {
 	char buf [64];
@@ -1271,12 +2019,14 @@ void TiXmlAttribute::SetDoubleValue( double _value )
 
 int TiXmlAttribute::IntValue() const
 {
-	return atoi (value.c_str ());
+	return atoi (Value ());
 }
 
 double  TiXmlAttribute::DoubleValue() const
 {
-	return atof (value.c_str ());
+	double d = 0.0;
+	QueryDoubleValue( &d );
+	return d;
 }
 
 
@@ -1501,6 +2251,10 @@ TiXmlAttributeSet::TiXmlAttributeSet()
 {
 	sentinel.next = &sentinel;
 	sentinel.prev = &sentinel;
+	count = 0;
+	index = 0;
+	indexSize = 0;
+	indexUsed = 0;
 }
 
 
@@ -1508,72 +2262,158 @@ TiXmlAttributeSet::~TiXmlAttributeSet()
 {
 	assert( sentinel.next == &sentinel );
 	assert( sentinel.prev == &sentinel );
+	TiXmlDeallocate( index );
 }
 
 
 void TiXmlAttributeSet::Add( TiXmlAttribute* addMe )
 {
-    #ifdef TIXML_USE_STL
-	assert( !Find( TIXML_STRING( addMe->Name() ) ) );	// Shouldn't be multiply adding to the set.
-	#else
 	assert( !Find( addMe->Name() ) );	// Shouldn't be multiply adding to the set.
-	#endif
 
 	addMe->next = &sentinel;
 	addMe->prev = sentinel.prev;
 
 	sentinel.prev->next = addMe;
 	sentinel.prev      = addMe;
+
+	addMe->set = this;
+	++count;
+	Index( addMe );
 }
 
 void TiXmlAttributeSet::Remove( TiXmlAttribute* removeMe )
 {
-	TiXmlAttribute* node;
+	if ( removeMe->set == this )
+	{
+		Unindex( removeMe );
+		--count;
+		removeMe->set = 0;
+		removeMe->prev->next = removeMe->next;
+		removeMe->next->prev = removeMe->prev;
+		removeMe->next = 0;
+		removeMe->prev = 0;
+		return;
+	}
+	assert( 0 );		// we tried to remove a non-linked attribute.
+}
+
+
+/*static*/ unsigned TiXmlAttributeSet::Hash( const char* name )
+{
+	unsigned hash = 2166136261u;
+	for ( ; *name; ++name )
+		hash = ( hash ^ (unsigned char) *name ) * 16777619u;
+	return hash;
+}
+
+
+TiXmlAttribute** TiXmlAttributeSet::Slot( const char* name ) const
+{
+	// Linear probing. Removed attributes leave the sentinel behind, which
+	// keeps the probe going but can be reused by Index().
+	int mask = indexSize - 1;
+	for ( int i = Hash( name ) & mask; ; i = ( i+1 ) & mask )
+	{
+		TiXmlAttribute* attribute = index[i];
+		if ( !attribute )
+			return &index[i];
+		if ( !Removed( attribute ) && strcmp( attribute->Name(), name ) == 0 )
+			return &index[i];
+	}
+}
+
+
+void TiXmlAttributeSet::Rebuild( int size )
+{
+	TiXmlDeallocate( index );
+	index = static_cast< TiXmlAttribute** >( TiXmlAllocate( size * sizeof( TiXmlAttribute* ) ) );
+	memset( index, 0, size * sizeof( TiXmlAttribute* ) );
+	indexSize = size;
+	indexUsed = count;
+	for( TiXmlAttribute* node = sentinel.next; node != &sentinel; node = node->next )
+	{
+		// Of two with the same name, Find() gets the first, as it would
+		// walking the list.
+		TiXmlAttribute** slot = Slot( node->Name() );
+		if ( !*slot )
+			*slot = node;
+	}
+}
 
-	for( node = sentinel.next; node != &sentinel; node = node->next )
+
+void TiXmlAttributeSet::Index( TiXmlAttribute* attribute )
+{
+	// Small sets are only ever walked; the table is built once there are
+	// enough attributes for that to be slow. Rebuilding also clears out
+	// the removed slots.
+	if ( index ? ( indexUsed+1 ) * 2 > indexSize : count > INDEX_THRESHOLD )
 	{
-		if ( node == removeMe )
+		int size = 16;
+		while ( count * 4 > size )
+			size *= 2;
+		Rebuild( size );
+		return;
+	}
+	if ( !index )
+		return;
+	// Reuse the first removed slot on the probe path, if there is one.
+	int mask = indexSize - 1;
+	for ( int i = Hash( attribute->Name() ) & mask; ; i = ( i+1 ) & mask )
+	{
+		if ( !index[i] )
 		{
-			node->prev->next = node->next;
-			node->next->prev = node->prev;
-			node->next = 0;
-			node->prev = 0;
+			++indexUsed;
+			index[i] = attribute;
+			return;
+		}
+		if ( Removed( index[i] ) )
+		{
+			index[i] = attribute;
 			return;
 		}
 	}
-	assert( 0 );		// we tried to remove a non-linked attribute.
 }
 
 
-#ifdef TIXML_USE_STL
-TiXmlAttribute* TiXmlAttributeSet::Find( const std::string& name ) const
+void TiXmlAttributeSet::Unindex( TiXmlAttribute* attribute )
 {
-	for( TiXmlAttribute* node = sentinel.next; node != &sentinel; node = node->next )
+	if ( !index )
+		return;
+	// Look for the attribute itself, not its name: a renamed attribute
+	// can share its name with another one.
+	int mask = indexSize - 1;
+	for ( int i = Hash( attribute->Name() ) & mask; index[i]; i = ( i+1 ) & mask )
 	{
-		if ( node->name == name )
-			return node;
+		if ( index[i] == attribute )
+		{
+			index[i] = &sentinel;
+			return;
+		}
 	}
-	return 0;
+}
+
+
+#ifdef TIXML_USE_STL
+TiXmlAttribute* TiXmlAttributeSet::Find( const std::string& name ) const
+{
+	return Find( name.c_str() );
 }
 
 TiXmlAttribute* TiXmlAttributeSet::FindOrCreate( const std::string& _name )
 {
-	TiXmlAttribute* attrib = Find( _name );
-	if ( !attrib ) {
-		attrib = new TiXmlAttribute();
-		Add( attrib );
-		attrib->SetName( _name );
-	}
-	return attrib;
+	return FindOrCreate( _name.c_str() );
 }
 #endif
 
 
 TiXmlAttribute* TiXmlAttributeSet::Find( const char* name ) const
 {
+	if ( index )
+		return *Slot( name );
+
 	for( TiXmlAttribute* node = sentinel.next; node != &sentinel; node = node->next )
 	{
-		if ( strcmp( node->name.c_str(), name ) == 0 )
+		if ( strcmp( node->Name(), name ) == 0 )
 			return node;
 	}
 	return 0;
@@ -1585,8 +2425,8 @@ TiXmlAttribute* TiXmlAttributeSet::FindOrCreate( const char* _name )
 	TiXmlAttribute* attrib = Find( _name );
 	if ( !attrib ) {
 		attrib = new TiXmlAttribute();
-		Add( attrib );
 		attrib->SetName( _name );
+		Add( attrib );
 	}
 	return attrib;
 }
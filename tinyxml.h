@@ -80,11 +80,18 @@ distribution.
 	#endif
 #endif	
 
+// Memory mapped loading (see TiXmlDocument::SetMemoryMapped) is only
+// available on systems with mmap(). Define TIXML_NO_MMAP to leave it out.
+#if !defined( TIXML_NO_MMAP ) && ( defined( __unix__ ) || defined( __APPLE__ ) )
+	#define TIXML_USE_MMAP
+#endif
+
 class TiXmlDocument;
 class TiXmlElement;
 class TiXmlComment;
 class TiXmlUnknown;
 class TiXmlAttribute;
+class TiXmlAttributeSet;
 class TiXmlText;
 class TiXmlDeclaration;
 class TiXmlParsingData;
@@ -93,6 +100,101 @@ const int TIXML_MAJOR_VERSION = 2;
 const int TIXML_MINOR_VERSION = 6;
 const int TIXML_PATCH_VERSION = 2;
 
+// Room for the longest text TiXmlBase::WriteDouble produces, and its null.
+const int TIXML_DOUBLE_LENGTH = 32;
+
+/**	A bump allocator: memory is handed out from a few large chunks, in
+	order, and only given back all at once. A document that has
+	SetArenaAllocated( true ) keeps one, and everything it creates while
+	parsing - nodes, attributes and the text of their strings - comes from
+	it. Deleting those is then nearly free, and the memory itself is
+	released one chunk at a time when the document is cleared, loaded
+	again or destroyed.
+*/
+class TiXmlArena
+{
+public:
+	TiXmlArena();
+	~TiXmlArena();
+
+	/// Returns size bytes, aligned for any type.
+	void* Allocate( size_t size );
+
+	/// Frees every chunk. Nothing allocated from the arena may be used afterwards.
+	void Reset();
+
+	/// The arena that TiXmlAllocate() uses on this thread, or null for the heap.
+	static TiXmlArena* Current();
+	/// Makes arena (which can be null) current on this thread. Returns the previous one.
+	static TiXmlArena* MakeCurrent( TiXmlArena* arena );
+
+private:
+	TiXmlArena( const TiXmlArena& );		// not allowed
+	void operator=( const TiXmlArena& );	// not allowed
+
+	struct Chunk
+	{
+		Chunk* next;
+	};
+
+	Chunk* chunks;		// newest first
+	char* cursor;		// free space in the newest chunk
+	char* end;
+	size_t chunkSize;	// of the next chunk; doubles up to a limit
+};
+
+/**	Interns names: each distinct name gets a small integer, its atom,
+	numbered from 1 up in the order they are first seen. 0 is never an
+	atom. Every document has one, for the names of the elements and
+	attributes it parses (see TiXmlDocument::Atom()). The names are kept
+	on the heap, so atoms outlive the document's arena and stay the same
+	across loads.
+*/
+class TiXmlAtomTable
+{
+public:
+	TiXmlAtomTable();
+	~TiXmlAtomTable();
+
+	/// Returns the atom for the length bytes at name, adding it if it is new.
+	int Intern( const char* name, size_t length );
+	/// Returns the atom for the length bytes at name, or 0 if there isn't one.
+	int Find( const char* name, size_t length ) const;
+	/// The name of an atom, or null if it isn't one.
+	const char* Name( int atom ) const	{ return ( atom > 0 && atom < count ) ? entries[atom].name : 0; }
+	/// One more than the largest atom: the size of an array indexed by atom.
+	int Count() const					{ return count; }
+
+private:
+	TiXmlAtomTable( const TiXmlAtomTable& );	// not allowed
+	void operator=( const TiXmlAtomTable& );	// not allowed
+
+	static unsigned Hash( const char* name, size_t length );
+	// The slot holding the atom for name, or the empty one it would go in.
+	int* Slot( const char* name, size_t length, unsigned hash ) const;
+
+	struct Entry
+	{
+		char* name;
+		size_t length;
+		unsigned hash;
+	};
+
+	Entry* entries;		// by atom; entries[0] is unused
+	int count;			// atoms so far, plus the unused 0
+	int capacity;		// of entries
+	int* slots;			// open addressing: an atom, or 0 if empty
+	int slotCount;		// a power of two, more than twice count
+};
+
+/*	Memory for nodes, attributes and string text. Comes from the current
+	TiXmlArena, if there is one, and from the heap otherwise; TiXmlDeallocate
+	works out which and does nothing for arena memory.
+*/
+void* TiXmlAllocate( size_t size );
+void TiXmlDeallocate( void* p );
+
+
 /*	Internal structure for tracking location of items 
 	in the XML file.
 */
@@ -150,6 +252,37 @@ public:
 	virtual bool Visit( const TiXmlUnknown& /*unknown*/ )			{ return true; }
 };
 
+/**
+	Implements the callbacks of TiXmlDocument::SaxLoadFile() and SaxParse().
+	Unlike TiXmlVisitor, which walks a DOM that has already been built, a
+	TiXmlSaxHandler is called while the XML is being read, and no nodes are
+	ever created. Memory use is proportional to the depth of the document,
+	not its size.
+
+	For each element, StartElement() is called with its name, then Attribute()
+	once for every attribute, in document order, then the same for all child
+	elements, and finally EndElement(). Empty elements (<foo/>) get an
+	EndElement() as well. Text, comments and other nodes are skipped.
+
+	The strings passed in are only valid for the duration of the call.
+	If you return 'false' from any method, parsing stops. This is not an
+	error: the document's Error() stays false.
+
+	@sa TiXmlDocument::SaxLoadFile()
+*/
+class TiXmlSaxHandler
+{
+public:
+	virtual ~TiXmlSaxHandler() {}
+
+	/// An element start tag was read.
+	virtual bool StartElement( const char* /*name*/ )						{ return true; }
+	/// An attribute of the most recently started element was read.
+	virtual bool Attribute( const char* /*name*/, const char* /*value*/ )	{ return true; }
+	/// An element end tag (or the end of an empty element) was read.
+	virtual bool EndElement( const char* /*name*/ )							{ return true; }
+};
+
 // Only used by Attribute::Query functions
 enum 
 { 
@@ -169,6 +302,13 @@ enum TiXmlEncoding
 
 const TiXmlEncoding TIXML_DEFAULT_ENCODING = TIXML_ENCODING_UNKNOWN;
 
+// How TiXmlDocument::SetElementFilter() treats the elements it names.
+enum TiXmlElementFilter
+{
+	TIXML_FILTER_DENY,		// they are skipped
+	TIXML_FILTER_ALLOW		// all the others are skipped
+};
+
 /** TiXmlBase is a base class for every class in TinyXml.
 	It does little except to establish that TinyXml classes
 	can be printed and provide some utility functions.
@@ -201,6 +341,11 @@ public:
 	TiXmlBase()	:	userData(0)		{}
 	virtual ~TiXmlBase()			{}
 
+	/// Nodes and attributes are allocated with TiXmlAllocate(), so that
+	/// the ones a document creates while parsing can live in its arena.
+	static void* operator new( size_t size )	{ return TiXmlAllocate( size ); }
+	static void operator delete( void* p )		{ TiXmlDeallocate( p ); }
+
 	/**	All TinyXml classes can print themselves to a filestream
 		or the string class (TiXmlString in non-STL mode, std::string
 		in STL mode.) Either or both cfile and str can be null.
@@ -261,6 +406,20 @@ public:
 	*/
 	static void EncodeString( const TIXML_STRING& str, TIXML_STRING* out );
 
+	/** Reads a decimal number, [sign] digits [. digits] [e [sign] digits], starting
+		exactly at p. The result is correctly rounded and does not depend on the C
+		locale. Returns a pointer just past the number, or null if p does not start
+		with one (in which case value is not changed.)
+	*/
+	static const char* ReadDouble( const char* p, double* value );
+
+	/** Writes the shortest decimal text that ReadDouble (or strtod) reads back as
+		exactly value, in the notation of ECMAScript's Number.prototype.toString:
+		"0.1", "-250", "1e-7", "Infinity". buffer must hold TIXML_DOUBLE_LENGTH
+		characters. Returns a pointer to the null that ends the text.
+	*/
+	static char* WriteDouble( double value, char* buffer );
+
 	enum
 	{
 		TIXML_NO_ERROR = 0,
@@ -303,9 +462,9 @@ protected:
 	static bool StreamTo( std::istream * in, int character, TIXML_STRING * tag );
 	#endif
 
-	/*	Reads an XML name into the string provided. Returns
-		a pointer just past the last character of the name,
-		or 0 if the function has an error.
+	/*	Reads an XML name into the string provided, or only skips
+		it if name is null. Returns a pointer just past the last
+		character of the name, or 0 if the function has an error.
 	*/
 	static const char* ReadName( const char* p, TIXML_STRING* name, TiXmlEncoding encoding );
 
@@ -319,6 +478,13 @@ protected:
 									bool ignoreCase,			// whether to ignore case in the end tag
 									TiXmlEncoding encoding );	// the current encoding
 
+	/*	Reads text up to endChar in place, for an in situ parse: entities
+		are decoded over the text itself, which they never make longer,
+		and a null is written after it. Returns a pointer past endChar,
+		or 0 if there is an error.
+	*/
+	static char* ReadTextInSitu( char* p, char endChar, TiXmlEncoding encoding );
+
 	// If an entity has been found, transform it into a character.
 	static const char* GetEntity( const char* in, char* value, int* length, TiXmlEncoding encoding );
 
@@ -496,6 +662,13 @@ public:
 
 	const TIXML_STRING& ValueTStr() const { return value; }
 
+	/** For an element read by Parse() or LoadFile(), the atom of its name
+		in its document (see TiXmlDocument::Atom()), which is quicker to
+		compare than the name. 0 for other nodes, and once the value is
+		changed or the node is copied.
+	*/
+	int Atom() const { return atom; }
+
 	/** Changes the value of the node. Defined as:
 		@verbatim
 		Document:	filename of the xml file
@@ -505,15 +678,15 @@ public:
 		Text:		the text string
 		@endverbatim
 	*/
-	void SetValue(const char * _value) { value = _value;}
+	void SetValue(const char * _value) { value = _value; atom = 0; }
 
     #ifdef TIXML_USE_STL
 	/// STL std::string form.
-	void SetValue( const std::string& _value )	{ value = _value; }
+	void SetValue( const std::string& _value )	{ value = _value; atom = 0; }
 	#endif
 
 	/// Delete all the children of this node. Does not affect 'this'.
-	void Clear();
+	virtual void Clear();
 
 	/// One step up the DOM.
 	TiXmlNode* Parent()							{ return parent; }
@@ -754,6 +927,7 @@ protected:
 
 	TiXmlNode*		parent;
 	NodeType		type;
+	int				atom;		// of an element's name, or 0
 
 	TiXmlNode*		firstChild;
 	TiXmlNode*		lastChild;
@@ -785,6 +959,9 @@ public:
 	TiXmlAttribute() : TiXmlBase()
 	{
 		document = 0;
+		inSituName = inSituValue = 0;
+		atom = 0;
+		set = 0;
 		prev = next = 0;
 	}
 
@@ -795,6 +972,9 @@ public:
 		name = _name;
 		value = _value;
 		document = 0;
+		inSituName = inSituValue = 0;
+		atom = 0;
+		set = 0;
 		prev = next = 0;
 	}
 	#endif
@@ -805,19 +985,27 @@ public:
 		name = _name;
 		value = _value;
 		document = 0;
+		inSituName = inSituValue = 0;
+		atom = 0;
+		set = 0;
 		prev = next = 0;
 	}
 
-	const char*		Name()  const		{ return name.c_str(); }		///< Return the name of this attribute.
-	const char*		Value() const		{ return value.c_str(); }		///< Return the value of this attribute.
+	const char*		Name()  const		{ return inSituName ? inSituName : name.c_str(); }		///< Return the name of this attribute.
+	const char*		Value() const		{ return inSituValue ? inSituValue : value.c_str(); }	///< Return the value of this attribute.
 	#ifdef TIXML_USE_STL
-	const std::string& ValueStr() const	{ return value; }				///< Return the value of this attribute.
+	const std::string& ValueStr() const	{ return ValueTStr(); }			///< Return the value of this attribute.
 	#endif
 	int				IntValue() const;									///< Return the value of this attribute, converted to an integer.
 	double			DoubleValue() const;								///< Return the value of this attribute, converted to a double.
 
-	// Get the tinyxml string representation
-	const TIXML_STRING& NameTStr() const { return name; }
+	/// The atom of the name, as for TiXmlNode::Atom().
+	int Atom() const					{ return atom; }
+
+	// Get the tinyxml string representation. An in situ name (see
+	// TiXmlDocument::SetInSitu) is copied into it the first time, which
+	// writes to the attribute even though the call is const.
+	const TIXML_STRING& NameTStr() const;
 
 	/** QueryIntValue examines the value string. It is an alternative to the
 		IntValue() method with richer error checking.
@@ -832,17 +1020,17 @@ public:
 	/// QueryDoubleValue examines the value string. See QueryIntValue().
 	int QueryDoubleValue( double* _value ) const;
 
-	void SetName( const char* _name )	{ name = _name; }				///< Set the name of this attribute.
-	void SetValue( const char* _value )	{ value = _value; }				///< Set the value.
+	void SetName( const char* _name );									///< Set the name of this attribute.
+	void SetValue( const char* _value )	{ value = _value; inSituValue = 0; }	///< Set the value.
 
 	void SetIntValue( int _value );										///< Set the value from an integer.
 	void SetDoubleValue( double _value );								///< Set the value from a double.
 
     #ifdef TIXML_USE_STL
 	/// STL std::string form.
-	void SetName( const std::string& _name )	{ name = _name; }	
+	void SetName( const std::string& _name );
 	/// STL std::string form.	
-	void SetValue( const std::string& _value )	{ value = _value; }
+	void SetValue( const std::string& _value )	{ value = _value; inSituValue = 0; }
 	#endif
 
 	/// Get the next sibling attribute in the DOM. Returns null at end.
@@ -857,9 +1045,9 @@ public:
 		return const_cast< TiXmlAttribute* >( (const_cast< const TiXmlAttribute* >(this))->Previous() ); 
 	}
 
-	bool operator==( const TiXmlAttribute& rhs ) const { return rhs.name == name; }
-	bool operator<( const TiXmlAttribute& rhs )	 const { return name < rhs.name; }
-	bool operator>( const TiXmlAttribute& rhs )  const { return name > rhs.name; }
+	bool operator==( const TiXmlAttribute& rhs ) const { return strcmp( Name(), rhs.Name() ) == 0; }
+	bool operator<( const TiXmlAttribute& rhs )	 const { return strcmp( Name(), rhs.Name() ) < 0; }
+	bool operator>( const TiXmlAttribute& rhs )  const { return strcmp( Name(), rhs.Name() ) > 0; }
 
 	/*	Attribute parsing starts: first letter of the name
 						 returns: the next char after the value end quote
@@ -880,9 +1068,19 @@ private:
 	TiXmlAttribute( const TiXmlAttribute& );				// not implemented.
 	void operator=( const TiXmlAttribute& base );	// not allowed.
 
+	// The value as a string; an in situ value is copied into it first,
+	// which writes to the attribute as NameTStr() does.
+	const TIXML_STRING& ValueTStr() const;
+
 	TiXmlDocument*	document;	// A pointer back to a document, for error reporting.
-	TIXML_STRING name;
-	TIXML_STRING value;
+	mutable TIXML_STRING name;
+	mutable TIXML_STRING value;
+	// Set instead of name and value by an in situ parse: they point into
+	// the document's buffer.
+	mutable const char* inSituName;
+	mutable const char* inSituValue;
+	int atom;
+	TiXmlAttributeSet* set;		// that this is in, which indexes it by name
 	TiXmlAttribute*	prev;
 	TiXmlAttribute*	next;
 };
@@ -923,13 +1121,33 @@ public:
 #	endif
 
 
+	// [internal use]
+	// Take an attribute out of, and put it back in, the index by name,
+	// around a change of its name.
+	void Unindex( TiXmlAttribute* attribute );
+	void Index( TiXmlAttribute* attribute );
+
 private:
 	//*ME:	Because of hidden/disabled copy-construktor in TiXmlAttribute (sentinel-element),
 	//*ME:	this class must be also use a hidden/disabled copy-constructor !!!
 	TiXmlAttributeSet( const TiXmlAttributeSet& );	// not allowed
 	void operator=( const TiXmlAttributeSet& );	// not allowed (as TiXmlAttribute)
 
+	// Past this many attributes, Find() stops walking the list and uses
+	// an open-addressed hash table instead.
+	enum { INDEX_THRESHOLD = 8 };
+
+	static unsigned Hash( const char* name );
+	// The slot holding the named attribute, or the empty one it would go in.
+	TiXmlAttribute** Slot( const char* name ) const;
+	void Rebuild( int size );
+	bool Removed( const TiXmlAttribute* slot ) const	{ return slot == &sentinel; }
+
 	TiXmlAttribute sentinel;
+	int count;
+	TiXmlAttribute** index;		// null until count passes INDEX_THRESHOLD
+	int indexSize;				// a power of two
+	int indexUsed;				// slots that aren't empty, removed ones included
 };
 
 
@@ -1406,7 +1624,7 @@ public:
 	TiXmlDocument( const TiXmlDocument& copy );
 	TiXmlDocument& operator=( const TiXmlDocument& copy );
 
-	virtual ~TiXmlDocument() {}
+	virtual ~TiXmlDocument();
 
 	/** Load a file using the current document value.
 		Returns true if successful. Will delete any existing
@@ -1428,6 +1646,17 @@ public:
 	/// Save a file using the given FILE*. Returns true if successful.
 	bool SaveFile( FILE* ) const;
 
+	/** Read a file, reporting its elements and attributes to the handler
+		instead of building the DOM. The document has no children afterwards;
+		errors are reported through Error(), ErrorDesc() and ErrorRow() as
+		for LoadFile(). Combined with SetMemoryMapped() this never holds more
+		of the file in memory than the page cache does.
+		@sa TiXmlSaxHandler
+	*/
+	bool SaxLoadFile( const char* filename, TiXmlSaxHandler* handler, TiXmlEncoding encoding = TIXML_DEFAULT_ENCODING );
+	/// Read the given FILE* with a TiXmlSaxHandler. See SaxLoadFile().
+	bool SaxLoadFile( FILE*, TiXmlSaxHandler* handler, TiXmlEncoding encoding = TIXML_DEFAULT_ENCODING );
+
 	#ifdef TIXML_USE_STL
 	bool LoadFile( const std::string& filename, TiXmlEncoding encoding = TIXML_DEFAULT_ENCODING )			///< STL std::string version.
 	{
@@ -1445,6 +1674,11 @@ public:
 	*/
 	virtual const char* Parse( const char* p, TiXmlParsingData* data = 0, TiXmlEncoding encoding = TIXML_DEFAULT_ENCODING );
 
+	/** Parse the given null terminated block of xml data, calling the handler
+		for every element instead of building the DOM. See SaxLoadFile().
+	*/
+	const char* SaxParse( const char* p, TiXmlSaxHandler* handler, TiXmlEncoding encoding = TIXML_DEFAULT_ENCODING );
+
 	/** Get the root element -- the only top level element -- of the document.
 		In well formed XML, there should only be one. TinyXml is tolerant of
 		multiple elements at the document level.
@@ -1505,6 +1739,103 @@ public:
 
 	int TabSize() const	{ return tabsize; }
 
+	/** SetMemoryMapped() makes LoadFile() map the file into memory and
+		parse it in place instead of reading a private copy. Only the pages
+		from the first carriage return onward are ever written to (by the
+		end-of-line normalization), so files with Unix line endings are
+		parsed straight out of the page cache.
+
+		If the file can't be mapped (a pipe, or a system without mmap),
+		LoadFile() silently falls back to reading it. The file must not be
+		truncated by another process while it is being loaded.
+	*/
+	void SetMemoryMapped( bool _memoryMapped )	{ memoryMapped = _memoryMapped; }
+	bool MemoryMapped() const					{ return memoryMapped; }
+
+	/** SetArenaAllocated() makes Parse() and LoadFile() allocate the nodes,
+		attributes and strings they create from an arena that belongs to
+		the document (see TiXmlArena), instead of one at a time from the
+		heap. It is all released together when the document is cleared,
+		loaded again or destroyed.
+
+		Nodes added or changed afterwards use the heap as usual. A node that
+		was parsed into an arena must not outlive its document: Clone() it
+		to keep it or move it to another document.
+	*/
+	void SetArenaAllocated( bool _arenaAllocated )	{ arenaAllocated = _arenaAllocated; }
+	bool ArenaAllocated() const						{ return arenaAllocated; }
+
+	/** SetInSitu() makes LoadFile() and SaxLoadFile() parse attributes in
+		place: rather than being copied into strings, their names and values
+		point into the loaded file, with their entities decoded where they
+		are and a null written after each. LoadFile() then keeps the file
+		for as long as the nodes; it is released when the document is
+		cleared, loaded again or destroyed.
+
+		An attribute that is changed afterwards, or whose NameTStr() or
+		ValueStr() is asked for, gets a copy of its own. Values that are not
+		quoted are always copied. With SetMemoryMapped(), each page an
+		attribute ends on is written to, and so is no longer shared with
+		the page cache.
+
+		Getting that copy writes to the attribute, even through a const
+		one. While several threads read the same document, none of them may
+		call NameTStr(), ValueStr() or the std::string forms of
+		TiXmlElement::Attribute() on an in situ attribute. Name(), Value(),
+		Print() and the rest of the const interface only read.
+	*/
+	void SetInSitu( bool _inSitu )	{ inSitu = _inSitu; }
+	bool InSitu() const				{ return inSitu; }
+
+	/** SetLocationTracking( false ) parses without working out the row
+		and column of every node as it goes, which costs a second pass
+		over every byte of the input. Row() and Column() of the nodes then
+		return 0. The location of an error is still reported: ErrorRow()
+		and ErrorCol() are counted from the start of the input when the
+		error is found.
+	*/
+	void SetLocationTracking( bool _trackLocations )	{ trackLocations = _trackLocations; }
+	bool LocationTracking() const						{ return trackLocations; }
+
+	/** SetElementFilter() makes Parse(), LoadFile() and SaxLoadFile() skip
+		elements by name, together with everything inside them. names are
+		separated by white space and compared case sensitively. With
+		TIXML_FILTER_DENY the elements named are skipped; with
+		TIXML_FILTER_ALLOW every element that isn't named is. The default,
+		an empty list of names to deny, keeps everything.
+
+		A skipped element is only scanned for where it ends: no nodes or
+		SAX callbacks are made for it, and nothing inside it is checked
+		except that its tags balance.
+		@verbatim
+		doc.SetElementFilter( "metadata sodipodi:namedview image", TIXML_FILTER_DENY );
+		@endverbatim
+	*/
+	void SetElementFilter( const char* names, TiXmlElementFilter mode )	{ filterNames = names; filterMode = mode; }
+	const char* ElementFilter() const									{ return filterNames.c_str(); }
+	TiXmlElementFilter ElementFilterMode() const						{ return filterMode; }
+
+	/** Parse() and LoadFile() intern the names of the elements and
+		attributes they read, so that each distinct name has an atom (see
+		TiXmlNode::Atom() and TiXmlAttribute::Atom()). Atom() returns the
+		atom for a name, or 0 if nothing by that name has been read, and
+		AtomName() the name for an atom. Atoms are never reused, so a
+		table indexed by atom, sized by AtomCount(), can classify names
+		once and then be looked up with no string compares:
+		@verbatim
+		int path = doc.Atom( "path" );
+		if ( element->Atom() == path ) ...
+		@endverbatim
+	*/
+	int Atom( const char* name ) const				{ return atoms.Find( name, strlen( name ) ); }
+	const char* AtomName( int atom ) const			{ return atoms.Name( atom ); }
+	int AtomCount() const							{ return atoms.Count(); }
+
+	/** Deletes every node, and frees the arena and the in situ buffer
+		they may have been parsed into. The settings and any error are kept.
+	*/
+	virtual void Clear();
+
 	/** If you have handled the error, it can be reset with this call. The error
 		state is automatically cleared if you Parse a new XML block.
 	*/
@@ -1528,6 +1859,12 @@ public:
 	virtual void Print( FILE* cfile, int depth = 0 ) const;
 	// [internal use]
 	void SetError( int err, const char* errorLocation, TiXmlParsingData* prevData, TiXmlEncoding encoding );
+	// [internal use]
+	// If the element that starts at p is one the filter skips, returns the
+	// char past its end (or null on an error); otherwise returns p.
+	const char* SkipFiltered( const char* p, TiXmlParsingData* data, TiXmlEncoding encoding );
+	// [internal use]
+	int Intern( const char* name, size_t length )	{ return atoms.Intern( name, length ); }
 
 	virtual const TiXmlDocument*    ToDocument()    const { return this; } ///< Cast to a more defined type. Will return null not of the requested type.
 	virtual TiXmlDocument*          ToDocument()          { return this; } ///< Cast to a more defined type. Will return null not of the requested type.
@@ -1546,12 +1883,48 @@ protected :
 private:
 	void CopyTo( TiXmlDocument* target ) const;
 
+	// Shared by LoadFile() and SaxLoadFile(). Builds the DOM if handler is null.
+	bool Load( FILE* file, TiXmlSaxHandler* handler, TiXmlEncoding encoding );
+	// Parses the buffer Load() has read or mapped, in situ if asked for.
+	// Returns true if the nodes point into buf, which must then be kept.
+	bool ParseLoaded( char* buf, TiXmlSaxHandler* handler, TiXmlEncoding encoding );
+	// Frees the buffer kept for in situ attributes.
+	void ReleaseInSituBuffer();
+
+	// The SAX parser. Both return the next char past the node, or null on an
+	// error or when the handler stopped the parse.
+	const char* SaxParseNode( const char* p, TiXmlParsingData* data, TiXmlSaxHandler* handler, TiXmlAttribute* attrib, TiXmlEncoding encoding );
+	const char* SaxParseElement( const char* p, TiXmlParsingData* data, TiXmlSaxHandler* handler, TiXmlAttribute* attrib, TiXmlEncoding encoding );
+
+	// The encoding named by an <?xml encoding="..."?> declaration.
+	static TiXmlEncoding DeclaredEncoding( const TiXmlDeclaration* dec );
+
+	// Translates CR+LF and lone CR to LF, in place, from buf up to the null
+	// terminator at end.
+	static void NormalizeNewLines( char* buf, const char* end );
+	#ifdef TIXML_USE_MMAP
+	// Maps the whole file, followed by a null terminator. Returns null if the
+	// file can't be mapped; otherwise munmap( buffer, *mapLength ) releases it.
+	static char* MapFile( FILE* file, long length, size_t* mapLength );
+	#endif
+
 	bool error;
 	int  errorId;
 	TIXML_STRING errorDesc;
 	int tabsize;
 	TiXmlCursor errorLocation;
 	bool useMicrosoftBOM;		// the UTF-8 BOM were found when read. Note this, and try to write.
+	bool memoryMapped;			// LoadFile() maps the file rather than reading it.
+	bool arenaAllocated;		// Parse() allocates from arena.
+	TiXmlArena arena;
+	bool inSitu;				// LoadFile() parses attributes in place.
+	bool parsingInSitu;			// the buffer being parsed belongs to Load() and may be written
+	char* inSituBuffer;			// the file the attributes point into, or null
+	size_t inSituMapLength;		// the length to munmap() it with, or 0 if it came from new[]
+	bool trackLocations;		// nodes get their row and column as they are parsed
+	TIXML_STRING filterNames;	// see SetElementFilter()
+	TiXmlElementFilter filterMode;
+	TiXmlAtomTable atoms;		// of element and attribute names
 };
 
 
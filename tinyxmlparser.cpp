@@ -24,6 +24,11 @@ distribution.
 
 #include <ctype.h>
 #include <stddef.h>
+#include <float.h>
+#include <locale.h>
+#if defined( __APPLE__ )
+#	include <xlocale.h>
+#endif
 
 #include "tinyxml.h"
 
@@ -168,6 +173,245 @@ void TiXmlBase::ConvertUTF32ToUTF8( unsigned long input, char* output, int* leng
 }
 
 
+/*	Scanners for the parser's hot loops. Each returns the first byte at
+	or after p that stops it; the null terminator always does.
+
+	SkipSpaces			stops at anything but ' ' and '\t' to '\r' (isspace()
+						in the "C" locale, as IsWhiteSpace() assumes.)
+	SkipNameChars		stops at anything ReadName() wouldn't take after the
+						first character: not a letter, digit, '_', '-', '.',
+						':' or a byte of 127 and up.
+	FindTextStop		stops at a, b, '&' and any byte of 128 and up - the
+						characters plain text can't simply be copied past.
+
+	On x86 they classify a whole 16 or 32 byte block at a time. Only aligned
+	blocks are read: one may run past the terminator, but never into
+	another page.
+*/
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#	define TIXML_X86_SCANNERS
+#	include <immintrin.h>
+#	include <stdint.h>
+#endif
+
+static const char* SkipSpacesScalar( const char* p )
+{
+	while ( *p == ' ' || ( *p >= '\t' && *p <= '\r' ) )
+		++p;
+	return p;
+}
+
+static const char* SkipNameCharsScalar( const char* p )
+{
+	for ( ;; ++p )
+	{
+		unsigned char c = (unsigned char) *p;
+		if ( ( ( c | 0x20 ) >= 'a' && ( c | 0x20 ) <= 'z' )
+			 || ( c >= '-' && c <= ':' && c != '/' )
+			 || c == '_' || c >= 127 )
+			continue;
+		return p;
+	}
+}
+
+static const char* FindTextStopScalar( const char* p, char a, char b )
+{
+	for ( ;; ++p )
+	{
+		char c = *p;
+		if ( c == a || c == b || c == '&' || c == 0 || ( (unsigned char) c ) >= 128 )
+			return p;
+	}
+}
+
+#ifdef TIXML_X86_SCANNERS
+
+// SSE2: a bit for each of the 16 bytes of v that stops the scan.
+
+__attribute__((target("sse2")))
+static inline __m128i InRangeSSE2( __m128i v, char lo, char hi )
+{
+	__m128i t = _mm_sub_epi8( v, _mm_set1_epi8( lo ) );
+	return _mm_cmpeq_epi8( _mm_min_epu8( t, _mm_set1_epi8( hi - lo ) ), t );
+}
+
+__attribute__((target("sse2")))
+static inline unsigned SpaceStopsSSE2( __m128i v )
+{
+	__m128i space = _mm_or_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( ' ' ) ), InRangeSSE2( v, '\t', '\r' ) );
+	return ~_mm_movemask_epi8( space ) & 0xffff;
+}
+
+__attribute__((target("sse2")))
+static inline unsigned NameStopsSSE2( __m128i v )
+{
+	__m128i letter = InRangeSSE2( _mm_or_si128( v, _mm_set1_epi8( 0x20 ) ), 'a', 'z' );
+	__m128i punct = _mm_andnot_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( '/' ) ), InRangeSSE2( v, '-', ':' ) );
+	__m128i under = _mm_cmpeq_epi8( v, _mm_set1_epi8( '_' ) );
+	__m128i high = _mm_cmpeq_epi8( _mm_max_epu8( v, _mm_set1_epi8( 127 ) ), v );
+	__m128i name = _mm_or_si128( _mm_or_si128( letter, punct ), _mm_or_si128( under, high ) );
+	return ~_mm_movemask_epi8( name ) & 0xffff;
+}
+
+__attribute__((target("sse2")))
+static inline unsigned TextStopsSSE2( __m128i v, __m128i a, __m128i b )
+{
+	__m128i stop = _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( v, a ), _mm_cmpeq_epi8( v, b ) ),
+								 _mm_or_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( '&' ) ), _mm_cmpeq_epi8( v, _mm_setzero_si128() ) ) );
+	// The sign bit is set for bytes of 128 and up.
+	return _mm_movemask_epi8( stop ) | _mm_movemask_epi8( v );
+}
+
+__attribute__((target("sse2"), no_sanitize_address))
+static const char* SkipSpacesSSE2( const char* p )
+{
+	const char* block = (const char*)( (uintptr_t) p & ~(uintptr_t) 15 );
+	unsigned stops = SpaceStopsSSE2( _mm_load_si128( (const __m128i*) block ) ) >> ( p - block ) << ( p - block );
+	while ( !stops )
+	{
+		block += 16;
+		stops = SpaceStopsSSE2( _mm_load_si128( (const __m128i*) block ) );
+	}
+	return block + __builtin_ctz( stops );
+}
+
+__attribute__((target("sse2"), no_sanitize_address))
+static const char* SkipNameCharsSSE2( const char* p )
+{
+	const char* block = (const char*)( (uintptr_t) p & ~(uintptr_t) 15 );
+	unsigned stops = NameStopsSSE2( _mm_load_si128( (const __m128i*) block ) ) >> ( p - block ) << ( p - block );
+	while ( !stops )
+	{
+		block += 16;
+		stops = NameStopsSSE2( _mm_load_si128( (const __m128i*) block ) );
+	}
+	return block + __builtin_ctz( stops );
+}
+
+__attribute__((target("sse2"), no_sanitize_address))
+static const char* FindTextStopSSE2( const char* p, char a, char b )
+{
+	__m128i va = _mm_set1_epi8( a );
+	__m128i vb = _mm_set1_epi8( b );
+	const char* block = (const char*)( (uintptr_t) p & ~(uintptr_t) 15 );
+	unsigned stops = TextStopsSSE2( _mm_load_si128( (const __m128i*) block ), va, vb ) >> ( p - block ) << ( p - block );
+	while ( !stops )
+	{
+		block += 16;
+		stops = TextStopsSSE2( _mm_load_si128( (const __m128i*) block ), va, vb );
+	}
+	return block + __builtin_ctz( stops );
+}
+
+// AVX2: the same, 32 bytes at a time.
+
+__attribute__((target("avx2")))
+static inline __m256i InRangeAVX2( __m256i v, char lo, char hi )
+{
+	__m256i t = _mm256_sub_epi8( v, _mm256_set1_epi8( lo ) );
+	return _mm256_cmpeq_epi8( _mm256_min_epu8( t, _mm256_set1_epi8( hi - lo ) ), t );
+}
+
+__attribute__((target("avx2")))
+static inline unsigned SpaceStopsAVX2( __m256i v )
+{
+	__m256i space = _mm256_or_si256( _mm256_cmpeq_epi8( v, _mm256_set1_epi8( ' ' ) ), InRangeAVX2( v, '\t', '\r' ) );
+	return ~(unsigned) _mm256_movemask_epi8( space );
+}
+
+__attribute__((target("avx2")))
+static inline unsigned NameStopsAVX2( __m256i v )
+{
+	__m256i letter = InRangeAVX2( _mm256_or_si256( v, _mm256_set1_epi8( 0x20 ) ), 'a', 'z' );
+	__m256i punct = _mm256_andnot_si256( _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '/' ) ), InRangeAVX2( v, '-', ':' ) );
+	__m256i under = _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '_' ) );
+	__m256i high = _mm256_cmpeq_epi8( _mm256_max_epu8( v, _mm256_set1_epi8( 127 ) ), v );
+	__m256i name = _mm256_or_si256( _mm256_or_si256( letter, punct ), _mm256_or_si256( under, high ) );
+	return ~(unsigned) _mm256_movemask_epi8( name );
+}
+
+__attribute__((target("avx2")))
+static inline unsigned TextStopsAVX2( __m256i v, __m256i a, __m256i b )
+{
+	__m256i stop = _mm256_or_si256( _mm256_or_si256( _mm256_cmpeq_epi8( v, a ), _mm256_cmpeq_epi8( v, b ) ),
+									_mm256_or_si256( _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '&' ) ), _mm256_cmpeq_epi8( v, _mm256_setzero_si256() ) ) );
+	// The sign bit is set for bytes of 128 and up.
+	return (unsigned) _mm256_movemask_epi8( stop ) | (unsigned) _mm256_movemask_epi8( v );
+}
+
+__attribute__((target("avx2"), no_sanitize_address))
+static const char* SkipSpacesAVX2( const char* p )
+{
+	const char* block = (const char*)( (uintptr_t) p & ~(uintptr_t) 31 );
+	unsigned stops = SpaceStopsAVX2( _mm256_load_si256( (const __m256i*) block ) ) >> ( p - block ) << ( p - block );
+	while ( !stops )
+	{
+		block += 32;
+		stops = SpaceStopsAVX2( _mm256_load_si256( (const __m256i*) block ) );
+	}
+	return block + __builtin_ctz( stops );
+}
+
+__attribute__((target("avx2"), no_sanitize_address))
+static const char* SkipNameCharsAVX2( const char* p )
+{
+	const char* block = (const char*)( (uintptr_t) p & ~(uintptr_t) 31 );
+	unsigned stops = NameStopsAVX2( _mm256_load_si256( (const __m256i*) block ) ) >> ( p - block ) << ( p - block );
+	while ( !stops )
+	{
+		block += 32;
+		stops = NameStopsAVX2( _mm256_load_si256( (const __m256i*) block ) );
+	}
+	return block + __builtin_ctz( stops );
+}
+
+__attribute__((target("avx2"), no_sanitize_address))
+static const char* FindTextStopAVX2( const char* p, char a, char b )
+{
+	__m256i va = _mm256_set1_epi8( a );
+	__m256i vb = _mm256_set1_epi8( b );
+	const char* block = (const char*)( (uintptr_t) p & ~(uintptr_t) 31 );
+	unsigned stops = TextStopsAVX2( _mm256_load_si256( (const __m256i*) block ), va, vb ) >> ( p - block ) << ( p - block );
+	while ( !stops )
+	{
+		block += 32;
+		stops = TextStopsAVX2( _mm256_load_si256( (const __m256i*) block ), va, vb );
+	}
+	return block + __builtin_ctz( stops );
+}
+
+#endif	// TIXML_X86_SCANNERS
+
+struct TiXmlScanners
+{
+	const char* (*skipSpaces)( const char* p );
+	const char* (*skipNameChars)( const char* p );
+	const char* (*findTextStop)( const char* p, char a, char b );
+};
+
+// The widest the CPU has.
+static const TiXmlScanners* SelectScanners()
+{
+	static const TiXmlScanners scalar = { SkipSpacesScalar, SkipNameCharsScalar, FindTextStopScalar };
+	#ifdef TIXML_X86_SCANNERS
+	static const TiXmlScanners sse2 = { SkipSpacesSSE2, SkipNameCharsSSE2, FindTextStopSSE2 };
+	static const TiXmlScanners avx2 = { SkipSpacesAVX2, SkipNameCharsAVX2, FindTextStopAVX2 };
+	__builtin_cpu_init();
+	if ( __builtin_cpu_supports( "avx2" ) )
+		return &avx2;
+	if ( __builtin_cpu_supports( "sse2" ) )
+		return &sse2;
+	#endif
+	return &scalar;
+}
+
+// Picked once, on first use.
+static inline const TiXmlScanners& Scanners()
+{
+	static const TiXmlScanners* scanners = SelectScanners();
+	return *scanners;
+}
+
 class TiXmlParsingData
 {
 	friend class TiXmlDocument;
@@ -176,6 +420,15 @@ class TiXmlParsingData
 
 	const TiXmlCursor& Cursor() const	{ return cursor; }
 
+	// Whether the buffer may be written to by an in situ parse.
+	bool InSitu() const					{ return inSitu; }
+	// Whether nodes are stamped with their location as they are parsed.
+	// If not, Stamp() is only called for an error.
+	bool TracksLocations() const		{ return trackLocations; }
+	// Whether element and attribute names are interned. A SAX parse hands
+	// names straight to its handler and never looks at the atoms.
+	bool InternsNames() const			{ return internNames; }
+
   private:
 	// Only used by the document!
 	TiXmlParsingData( const char* start, int _tabsize, int row, int col )
@@ -185,11 +438,17 @@ class TiXmlParsingData
 		tabsize = _tabsize;
 		cursor.row = row;
 		cursor.col = col;
+		inSitu = false;
+		trackLocations = true;
+		internNames = true;
 	}
 
 	TiXmlCursor		cursor;
 	const char*		stamp;
 	int				tabsize;
+	bool			inSitu;
+	bool			trackLocations;
+	bool			internNames;
 };
 
 
@@ -217,9 +476,15 @@ void TiXmlParsingData::Stamp( const char* now, TiXmlEncoding encoding )
 		// Code contributed by Fletcher Dunn: (modified by lee)
 		switch (*pU) {
 			case 0:
-				// We *should* never get here, but in case we do, don't
-				// advance past the terminating null character, ever
-				return;
+				// An in situ parse leaves nulls in place of the character
+				// after each attribute name and value. Otherwise we *should*
+				// never get here, but in case we do, don't advance past the
+				// terminating null character, ever
+				if ( !inSitu )
+					return;
+				++p;
+				++col;
+				break;
 
 			case '\r':
 				// bump down to the next line
@@ -347,15 +612,14 @@ const char* TiXmlBase::SkipWhiteSpace( const char* p, TiXmlEncoding encoding )
 			}
 
 			if ( IsWhiteSpace( *p ) )		// Still using old rules for white space.
-				++p;
+				p = Scanners().skipSpaces( p+1 );
 			else
 				break;
 		}
 	}
-	else
+	else if ( IsWhiteSpace( *p ) )
 	{
-		while ( *p && IsWhiteSpace( *p ) )
-			++p;
+		p = Scanners().skipSpaces( p+1 );
 	}
 
 	return p;
@@ -403,7 +667,8 @@ const char* TiXmlBase::ReadName( const char* p, TIXML_STRING * name, TiXmlEncodi
 	// Oddly, not supported on some comilers,
 	//name->clear();
 	// So use this:
-	*name = "";
+	if ( name )
+		*name = "";
 	assert( p );
 
 	// Names start with letters or underscores.
@@ -416,18 +681,10 @@ const char* TiXmlBase::ReadName( const char* p, TIXML_STRING * name, TiXmlEncodi
 	if (    p && *p 
 		 && ( IsAlpha( (unsigned char) *p, encoding ) || *p == '_' ) )
 	{
+		// The rest are IsAlphaNum(), '_', '-', '.' or ':'.
 		const char* start = p;
-		while(		p && *p
-				&&	(		IsAlphaNum( (unsigned char ) *p, encoding ) 
-						 || *p == '_'
-						 || *p == '-'
-						 || *p == '.'
-						 || *p == ':' ) )
-		{
-			//(*name) += *p; // expensive
-			++p;
-		}
-		if ( p-start > 0 ) {
+		p = Scanners().skipNameChars( p+1 );
+		if ( name && p-start > 0 ) {
 			name->assign( start, p-start );
 		}
 		return p;
@@ -435,6 +692,150 @@ const char* TiXmlBase::ReadName( const char* p, TIXML_STRING * name, TiXmlEncodi
 	return 0;
 }
 
+// strtod() in the "C" locale whatever the program has set, so a decimal
+// point is always '.'. The locale is made once and never freed.
+static double StrtodC( const char* text )
+{
+#if defined( _MSC_VER )
+	static const _locale_t c = _create_locale( LC_NUMERIC, "C" );
+	if ( c )
+		return _strtod_l( text, 0, c );
+#else
+	static const locale_t c = newlocale( LC_NUMERIC_MASK, "C", (locale_t) 0 );
+	if ( c )
+		return strtod_l( text, 0, c );
+#endif
+	return strtod( text, 0 );
+}
+
+/*static*/ const char* TiXmlBase::ReadDouble( const char* p, double* value )
+{
+	// Exact powers of ten. Every one of these is representable in a double.
+	static const double powersOfTen[] =
+	{
+		1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	const int MAX_DIGITS = 19;		// that always fit in 64 bits
+
+	const char* start = p;
+	bool negative = false;
+	if ( *p == '+' || *p == '-' )
+	{
+		negative = ( *p == '-' );
+		++p;
+	}
+
+	// Gather up to MAX_DIGITS significant digits into the mantissa, and keep
+	// track of the power of ten it has to be scaled by.
+	unsigned long long mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool truncated = false;
+	bool anyDigits = false;
+
+	for ( ; *p >= '0' && *p <= '9'; ++p )
+	{
+		anyDigits = true;
+		if ( digits < MAX_DIGITS )
+		{
+			mantissa = mantissa * 10 + ( *p - '0' );
+			if ( mantissa )
+				++digits;
+		}
+		else
+		{
+			++exponent;
+			truncated = truncated || *p != '0';
+		}
+	}
+	if ( *p == '.' )
+	{
+		for ( ++p; *p >= '0' && *p <= '9'; ++p )
+		{
+			anyDigits = true;
+			if ( digits < MAX_DIGITS )
+			{
+				mantissa = mantissa * 10 + ( *p - '0' );
+				if ( mantissa )
+					++digits;
+				--exponent;
+			}
+			else
+			{
+				truncated = truncated || *p != '0';
+			}
+		}
+	}
+	if ( !anyDigits )
+		return 0;
+
+	if ( *p == 'e' || *p == 'E' )
+	{
+		const char* q = p+1;
+		bool negativeExponent = false;
+		if ( *q == '+' || *q == '-' )
+		{
+			negativeExponent = ( *q == '-' );
+			++q;
+		}
+		if ( *q >= '0' && *q <= '9' )
+		{
+			int e = 0;
+			for ( ; *q >= '0' && *q <= '9'; ++q )
+			{
+				if ( e < 100000 )	// far out of range either way
+					e = e * 10 + ( *q - '0' );
+			}
+			exponent += negativeExponent ? -e : e;
+			p = q;
+		}
+	}
+
+	// Clinger's fast path: when the mantissa and the power of ten are both exact
+	// doubles, one IEEE multiply or divide gives the correctly rounded result.
+	// Short coordinates like "-46.37289" always land here.
+	#if defined( FLT_EVAL_METHOD ) && FLT_EVAL_METHOD == 0
+	if ( mantissa == 0 )
+	{
+		*value = negative ? -0.0 : 0.0;
+		return p;
+	}
+	if (    !truncated
+		 && mantissa <= ( 1ULL << 53 )
+		 && exponent >= -22 && exponent <= 22 )
+	{
+		double d = (double) mantissa;
+		if ( exponent < 0 )
+			d /= powersOfTen[ -exponent ];
+		else
+			d *= powersOfTen[ exponent ];
+		*value = negative ? -d : d;
+		return p;
+	}
+	#endif
+
+	// Everything else (more than 15 or so digits, or huge exponents) is rare
+	// enough to hand to the C library, which gets it right if slowly. Pass it
+	// exactly the text matched above so the two can't disagree on the extent,
+	// and read it in the "C" locale so the '.' is understood.
+	char buf[ 64 ];
+	size_t length = p - start;
+	if ( length < sizeof( buf ) )
+	{
+		memcpy( buf, start, length );
+		buf[ length ] = 0;
+		*value = StrtodC( buf );
+	}
+	else
+	{
+		TIXML_STRING copy( start, length );
+		*value = StrtodC( copy.c_str() );
+	}
+	return p;
+}
+
+
 const char* TiXmlBase::GetEntity( const char* p, char* value, int* length, TiXmlEncoding encoding )
 {
 	// Presume an entity, and pull it out.
@@ -579,6 +980,15 @@ const char* TiXmlBase::ReadText(	const char* p,
 									TiXmlEncoding encoding )
 {
     *text = "";
+	// In an arena the buffers a string outgrows are not reused, so there
+	// the text, which is never longer than what it is read from, gets room
+	// once. On the heap they are, and growing is cheaper than a second pass.
+	if ( p && !caseInsensitive && TiXmlArena::Current() )
+	{
+		const char* end = strstr( p, endTag );
+		if ( end )
+			text->reserve( end - p );
+	}
 	if (    !trimWhiteSpace			// certain tags always keep whitespace
 		 || !condenseWhiteSpace )	// if true, whitespace is always kept
 	{
@@ -587,6 +997,15 @@ const char* TiXmlBase::ReadText(	const char* p,
 				&& !StringEqual( p, endTag, caseInsensitive, encoding )
 			  )
 		{
+			// Copy plain text a run at a time, up to anything GetChar() has
+			// to look at or that could start the end tag.
+			const char* run = Scanners().findTextStop( p, (char) tolower( *endTag ), (char) toupper( *endTag ) );
+			if ( run > p )
+			{
+				text->append( p, run - p );
+				p = run;
+				continue;
+			}
 			int len;
 			char cArr[4] = { 0, 0, 0, 0 };
 			p = GetChar( p, cArr, &len, encoding );
@@ -701,9 +1120,27 @@ void TiXmlDocument::StreamIn( std::istream * in, TIXML_STRING * tag )
 
 #endif
 
+// Makes an arena current for as long as it is in scope.
+class TiXmlArenaScope
+{
+public:
+	TiXmlArenaScope( TiXmlArena* arena ) : previous( TiXmlArena::MakeCurrent( arena ) ) {}
+	~TiXmlArenaScope()	{ TiXmlArena::MakeCurrent( previous ); }
+
+private:
+	TiXmlArena* previous;
+};
+
+
 const char* TiXmlDocument::Parse( const char* p, TiXmlParsingData* prevData, TiXmlEncoding encoding )
 {
 	ClearError();
+	// Only Load() asks for an in situ parse, and only of this call.
+	bool inSituParse = parsingInSitu;
+	parsingInSitu = false;
+
+	// Everything created from here on comes from the arena.
+	TiXmlArenaScope scope( arenaAllocated ? &arena : TiXmlArena::Current() );
 
 	// Parse away, at the document level. Since a document
 	// contains nothing but other tags, most of what happens
@@ -730,6 +1167,8 @@ const char* TiXmlDocument::Parse( const char* p, TiXmlParsingData* prevData, TiX
 	}
 	TiXmlParsingData data( p, TabSize(), location.row, location.col );
 	location = data.Cursor();
+	data.inSitu = inSituParse;
+	data.trackLocations = trackLocations;
 
 	if ( encoding == TIXML_ENCODING_UNKNOWN )
 	{
@@ -753,6 +1192,14 @@ const char* TiXmlDocument::Parse( const char* p, TiXmlParsingData* prevData, TiX
 
 	while ( p && *p )
 	{
+		// Filtered out elements are never made into nodes.
+		const char* skipped = SkipFiltered( p, &data, encoding );
+		if ( skipped != p )
+		{
+			p = SkipWhiteSpace( skipped, encoding );
+			continue;
+		}
+
 		TiXmlNode* node = Identify( p, encoding );
 		if ( node )
 		{
@@ -768,18 +1215,7 @@ const char* TiXmlDocument::Parse( const char* p, TiXmlParsingData* prevData, TiX
 		if (    encoding == TIXML_ENCODING_UNKNOWN
 			 && node->ToDeclaration() )
 		{
-			TiXmlDeclaration* dec = node->ToDeclaration();
-			const char* enc = dec->Encoding();
-			assert( enc );
-
-			if ( *enc == 0 )
-				encoding = TIXML_ENCODING_UTF8;
-			else if ( StringEqual( enc, "UTF-8", true, TIXML_ENCODING_UNKNOWN ) )
-				encoding = TIXML_ENCODING_UTF8;
-			else if ( StringEqual( enc, "UTF8", true, TIXML_ENCODING_UNKNOWN ) )
-				encoding = TIXML_ENCODING_UTF8;	// incorrect, but be nice
-			else 
-				encoding = TIXML_ENCODING_LEGACY;
+			encoding = DeclaredEncoding( node->ToDeclaration() );
 		}
 
 		p = SkipWhiteSpace( p, encoding );
@@ -804,17 +1240,309 @@ void TiXmlDocument::SetError( int err, const char* pError, TiXmlParsingData* dat
 	assert( err > 0 && err < TIXML_ERROR_STRING_COUNT );
 	error   = true;
 	errorId = err;
-	errorDesc = errorString[ errorId ];
+	{
+		// the document's own string must outlive its arena
+		TiXmlArenaScope scope( 0 );
+		errorDesc = errorString[ errorId ];
+	}
 
 	errorLocation.Clear();
 	if ( pError && data )
 	{
+		// Without location tracking nothing has been stamped yet, so this
+		// counts from the start of the input up to the error.
 		data->Stamp( pError, encoding );
 		errorLocation = data->Cursor();
 	}
 }
 
 
+/*static*/ TiXmlEncoding TiXmlDocument::DeclaredEncoding( const TiXmlDeclaration* dec )
+{
+	const char* enc = dec->Encoding();
+	assert( enc );
+
+	if ( *enc == 0 )
+		return TIXML_ENCODING_UTF8;
+	else if ( StringEqual( enc, "UTF-8", true, TIXML_ENCODING_UNKNOWN ) )
+		return TIXML_ENCODING_UTF8;
+	else if ( StringEqual( enc, "UTF8", true, TIXML_ENCODING_UNKNOWN ) )
+		return TIXML_ENCODING_UTF8;	// incorrect, but be nice
+	else 
+		return TIXML_ENCODING_LEGACY;
+}
+
+
+// Returns the char past the first endTag at or after p, or the
+// terminating null if there isn't one.
+static const char* SkipPast( const char* p, const char* endTag )
+{
+	const char* q = strstr( p, endTag );
+	if ( !q )
+		return p + strlen( p );
+	return q + strlen( endTag );
+}
+
+
+// Returns the char past the end of the element whose start tag is at p,
+// or null if the input ends first. Only the tags are looked at: comments,
+// CDATA sections and the like are passed over whole, and so are quoted
+// attribute values, which may hold a '>'.
+static const char* SkipElement( const char* p )
+{
+	int depth = 0;
+	do
+	{
+		// p is at a '<'.
+		if ( strncmp( p, "<!--", 4 ) == 0 )
+		{
+			p = strstr( p+4, "-->" );
+			if ( p ) p += 3;
+		}
+		else if ( strncmp( p, "<![CDATA[", 9 ) == 0 )
+		{
+			p = strstr( p+9, "]]>" );
+			if ( p ) p += 3;
+		}
+		else if ( *(p+1) == '/' || *(p+1) == '?' || *(p+1) == '!' )
+		{
+			if ( *(p+1) == '/' )
+				--depth;
+			p = strchr( p+2, '>' );
+			if ( p ) ++p;
+		}
+		else
+		{
+			// A start tag. It opens an element unless it ends with "/>".
+			p += strcspn( p, "\"'>" );
+			while ( *p == '\"' || *p == '\'' )
+			{
+				p = strchr( p+1, *p );
+				if ( !p )
+					return 0;
+				p += 1 + strcspn( p+1, "\"'>" );
+			}
+			if ( !*p )
+				return 0;
+			if ( *(p-1) != '/' )
+				++depth;
+			++p;
+		}
+		if ( !p )
+			return 0;
+		if ( depth == 0 )
+			return p;
+		p = strchr( p, '<' );
+	} while ( p );
+	return 0;
+}
+
+
+const char* TiXmlDocument::SkipFiltered( const char* p, TiXmlParsingData* data, TiXmlEncoding encoding )
+{
+	if ( filterNames.empty() && filterMode == TIXML_FILTER_DENY )
+		return p;
+	if ( *p != '<' || !( IsAlpha( *(p+1), encoding ) || *(p+1) == '_' ) )
+		return p;
+
+	// Is the element's name in the list?
+	const char* name = p+1;
+	size_t length = Scanners().skipNameChars( name+1 ) - name;
+	bool listed = false;
+	const char* word = Scanners().skipSpaces( filterNames.c_str() );
+	while ( *word && !listed )
+	{
+		const char* wordEnd = word;
+		while ( *wordEnd && !IsWhiteSpace( *wordEnd ) )
+			++wordEnd;
+		listed = ( (size_t)( wordEnd - word ) == length && strncmp( word, name, length ) == 0 );
+		word = Scanners().skipSpaces( wordEnd );
+	}
+	if ( listed == ( filterMode == TIXML_FILTER_ALLOW ) )
+		return p;
+
+	const char* end = SkipElement( p );
+	if ( !end )
+		SetError( TIXML_ERROR_READING_END_TAG, p, data, encoding );
+	return end;
+}
+
+
+const char* TiXmlDocument::SaxParse( const char* p, TiXmlSaxHandler* handler, TiXmlEncoding encoding )
+{
+	ClearError();
+	// Only Load() asks for an in situ parse, and only of this call.
+	bool inSituParse = parsingInSitu;
+	parsingInSitu = false;
+
+	if ( !p || !*p )
+	{
+		SetError( TIXML_ERROR_DOCUMENT_EMPTY, 0, 0, TIXML_ENCODING_UNKNOWN );
+		return 0;
+	}
+
+	location.row = 0;
+	location.col = 0;
+	TiXmlParsingData data( p, TabSize(), location.row, location.col );
+	data.inSitu = inSituParse;
+	data.trackLocations = trackLocations;
+	data.internNames = false;
+
+	if ( encoding == TIXML_ENCODING_UNKNOWN )
+	{
+		// Check for the Microsoft UTF-8 lead bytes.
+		const unsigned char* pU = (const unsigned char*)p;
+		if (	*(pU+0) && *(pU+0) == TIXML_UTF_LEAD_0
+			 && *(pU+1) && *(pU+1) == TIXML_UTF_LEAD_1
+			 && *(pU+2) && *(pU+2) == TIXML_UTF_LEAD_2 )
+		{
+			encoding = TIXML_ENCODING_UTF8;
+			useMicrosoftBOM = true;
+		}
+	}
+
+	// One attribute is reused for every attribute in the document.
+	TiXmlAttribute attrib;
+	attrib.SetDocument( this );
+
+	bool empty = true;
+	p = SkipWhiteSpace( p, encoding );
+	while ( p && *p && *p == '<' )
+	{
+		empty = false;
+		if ( StringEqual( p, "<?xml", true, encoding ) )
+		{
+			TiXmlDeclaration dec;
+			p = dec.Parse( p, &data, encoding );
+			if ( encoding == TIXML_ENCODING_UNKNOWN )
+				encoding = DeclaredEncoding( &dec );
+		}
+		else
+		{
+			p = SaxParseNode( p, &data, handler, &attrib, encoding );
+		}
+		p = SkipWhiteSpace( p, encoding );
+	}
+
+	if ( empty && !Error() ) {
+		SetError( TIXML_ERROR_DOCUMENT_EMPTY, 0, 0, encoding );
+		return 0;
+	}
+	return p;
+}
+
+
+const char* TiXmlDocument::SaxParseNode( const char* p, TiXmlParsingData* data, TiXmlSaxHandler* handler, TiXmlAttribute* attrib, TiXmlEncoding encoding )
+{
+	// The same classification as Identify(), but nothing that
+	// isn't an element is kept.
+	assert( *p == '<' );
+	if ( StringEqual( p, "<!--", false, encoding ) )
+		return SkipPast( p+4, "-->" );
+	if ( StringEqual( p, "<![CDATA[", false, encoding ) )
+		return SkipPast( p+9, "]]>" );
+	if ( IsAlpha( *(p+1), encoding ) || *(p+1) == '_' )
+	{
+		const char* skipped = SkipFiltered( p, data, encoding );
+		if ( skipped != p )
+			return skipped;
+		return SaxParseElement( p, data, handler, attrib, encoding );
+	}
+	// Declarations, DTDs and unknowns.
+	return SkipPast( p+1, ">" );
+}
+
+
+const char* TiXmlDocument::SaxParseElement( const char* p, TiXmlParsingData* data, TiXmlSaxHandler* handler, TiXmlAttribute* attrib, TiXmlEncoding encoding )
+{
+	// Mirrors TiXmlElement::Parse() and ReadValue().
+	p = SkipWhiteSpace( p+1, encoding );
+
+	TIXML_STRING name;
+	const char* pErr = p;
+	p = ReadName( p, &name, encoding );
+	if ( !p || !*p )
+	{
+		SetError( TIXML_ERROR_FAILED_TO_READ_ELEMENT_NAME, pErr, data, encoding );
+		return 0;
+	}
+	if ( !handler->StartElement( name.c_str() ) )
+		return 0;
+
+	while ( p && *p )
+	{
+		pErr = p;
+		p = SkipWhiteSpace( p, encoding );
+		if ( !p || !*p )
+		{
+			SetError( TIXML_ERROR_READING_ATTRIBUTES, pErr, data, encoding );
+			return 0;
+		}
+		if ( *p == '/' )
+		{
+			++p;
+			// Empty tag.
+			if ( *p != '>' )
+			{
+				SetError( TIXML_ERROR_PARSING_EMPTY, p, data, encoding );
+				return 0;
+			}
+			return handler->EndElement( name.c_str() ) ? p+1 : 0;
+		}
+		else if ( *p == '>' )
+		{
+			// Read the children, which are skipped unless they are elements.
+			++p;
+			while ( p && *p && !StringEqual( p, "</", false, encoding ) )
+			{
+				if ( *p == '<' )
+				{
+					p = SaxParseNode( p, data, handler, attrib, encoding );
+				}
+				else
+				{
+					const char* text = strchr( p, '<' );
+					p = text ? text : p + strlen( p );
+				}
+			}
+			if ( !p ) {
+				// The error, if any, has been set by the child.
+				return 0;
+			}
+			if ( !*p ) {
+				SetError( TIXML_ERROR_READING_END_TAG, p, data, encoding );
+				return 0;
+			}
+
+			// </foo > and </foo> are both valid end tags.
+			p += 2;
+			if ( strncmp( p, name.c_str(), name.length() ) == 0 )
+			{
+				p = SkipWhiteSpace( p + name.length(), encoding );
+				if ( p && *p && *p == '>' ) {
+					return handler->EndElement( name.c_str() ) ? p+1 : 0;
+				}
+			}
+			SetError( TIXML_ERROR_READING_END_TAG, p, data, encoding );
+			return 0;
+		}
+		else
+		{
+			pErr = p;
+			p = attrib->Parse( p, data, encoding );
+			if ( !p || !*p )
+			{
+				SetError( TIXML_ERROR_PARSING_ELEMENT, pErr, data, encoding );
+				return 0;
+			}
+			if ( !handler->Attribute( attrib->Name(), attrib->Value() ) )
+				return 0;
+		}
+	}
+	return p;
+}
+
+
 TiXmlNode* TiXmlNode::Identify( const char* p, TiXmlEncoding encoding )
 {
 	TiXmlNode* returnNode = 0;
@@ -1051,7 +1779,7 @@ const char* TiXmlElement::Parse( const char* p, TiXmlParsingData* data, TiXmlEnc
 		return 0;
 	}
 
-	if ( data )
+	if ( data && data->TracksLocations() )
 	{
 		data->Stamp( p, encoding );
 		location = data->Cursor();
@@ -1074,6 +1802,7 @@ const char* TiXmlElement::Parse( const char* p, TiXmlParsingData* data, TiXmlEnc
 		if ( document )	document->SetError( TIXML_ERROR_FAILED_TO_READ_ELEMENT_NAME, pErr, data, encoding );
 		return 0;
 	}
+	atom = ( document && ( !data || data->InternsNames() ) ) ? document->Intern( value.c_str(), value.length() ) : 0;
 
     TIXML_STRING endTag ("</");
 	endTag += value;
@@ -1157,11 +1886,7 @@ const char* TiXmlElement::Parse( const char* p, TiXmlParsingData* data, TiXmlEnc
 			}
 
 			// Handle the strange case of double attributes:
-			#ifdef TIXML_USE_STL
-			TiXmlAttribute* node = attributeSet.Find( attrib->NameTStr() );
-			#else
 			TiXmlAttribute* node = attributeSet.Find( attrib->Name() );
-			#endif
 			if ( node )
 			{
 				if ( document ) document->SetError( TIXML_ERROR_PARSING_ELEMENT, pErr, data, encoding );
@@ -1223,15 +1948,25 @@ const char* TiXmlElement::ReadValue( const char* p, TiXmlParsingData* data, TiXm
 			}
 			else
 			{
-				TiXmlNode* node = Identify( p, encoding );
-				if ( node )
+				// Elements the document's filter leaves out are never made
+				// into nodes.
+				const char* skipped = document ? document->SkipFiltered( p, data, encoding ) : p;
+				if ( skipped != p )
 				{
-					p = node->Parse( p, data, encoding );
-					LinkEndChild( node );
-				}				
+					p = skipped;
+				}
 				else
 				{
-					return 0;
+					TiXmlNode* node = Identify( p, encoding );
+					if ( node )
+					{
+						p = node->Parse( p, data, encoding );
+						LinkEndChild( node );
+					}				
+					else
+					{
+						return 0;
+					}
 				}
 			}
 		}
@@ -1277,7 +2012,7 @@ const char* TiXmlUnknown::Parse( const char* p, TiXmlParsingData* data, TiXmlEnc
 	TiXmlDocument* document = GetDocument();
 	p = SkipWhiteSpace( p, encoding );
 
-	if ( data )
+	if ( data && data->TracksLocations() )
 	{
 		data->Stamp( p, encoding );
 		location = data->Cursor();
@@ -1341,7 +2076,7 @@ const char* TiXmlComment::Parse( const char* p, TiXmlParsingData* data, TiXmlEnc
 
 	p = SkipWhiteSpace( p, encoding );
 
-	if ( data )
+	if ( data && data->TracksLocations() )
 	{
 		data->Stamp( p, encoding );
 		location = data->Cursor();
@@ -1389,24 +2124,83 @@ const char* TiXmlComment::Parse( const char* p, TiXmlParsingData* data, TiXmlEnc
 }
 
 
+char* TiXmlBase::ReadTextInSitu( char* p, char endChar, TiXmlEncoding encoding )
+{
+	char* q = p;	// the write head; nothing moves until the first entity
+
+	while ( *p && *p != endChar )
+	{
+		char* run = const_cast< char* >( Scanners().findTextStop( p, endChar, endChar ) );
+		if ( run > p )
+		{
+			if ( q < p )
+				memmove( q, p, run - p );
+			q += run - p;
+			p = run;
+		}
+		else if ( *p == '&' )
+		{
+			int len;
+			char cArr[4];
+			p = const_cast< char* >( GetEntity( p, cArr, &len, encoding ) );
+			if ( !p )
+				return 0;
+			memcpy( q, cArr, len );
+			q += len;
+		}
+		else
+		{
+			// Multi-byte characters are kept whole, as GetChar() does.
+			int len = ( encoding == TIXML_ENCODING_UTF8 ) ? utf8ByteTable[ *((unsigned char*)p) ] : 1;
+			for ( int i=0; *p && i<len; ++i )
+				*q++ = *p++;
+		}
+	}
+	if ( !*p )
+		return 0;
+
+	// The gap left by the entities is blanked, so that the row and column
+	// of what follows are still counted correctly.
+	*q = 0;
+	if ( q < p )
+		memset( q+1, ' ', p-q-1 );
+	return p+1;
+}
+
+
 const char* TiXmlAttribute::Parse( const char* p, TiXmlParsingData* data, TiXmlEncoding encoding )
 {
 	p = SkipWhiteSpace( p, encoding );
 	if ( !p || !*p ) return 0;
 
-	if ( data )
+	if ( data && data->TracksLocations() )
 	{
 		data->Stamp( p, encoding );
 		location = data->Cursor();
 	}
+	// In situ, the name and value are left where they are and only
+	// terminated once the whole attribute has been read.
+	bool inSitu = data && data->InSitu();
+	char* nameEnd = 0;
+
 	// Read the name, the '=' and the value.
 	const char* pErr = p;
-	p = ReadName( p, &name, encoding );
+	p = ReadName( p, inSitu ? 0 : &name, encoding );
 	if ( !p || !*p )
 	{
 		if ( document ) document->SetError( TIXML_ERROR_READING_ATTRIBUTES, pErr, data, encoding );
 		return 0;
 	}
+	if ( inSitu )
+	{
+		inSituName = pErr;
+		nameEnd = const_cast< char* >( p );
+	}
+	else
+	{
+		inSituName = 0;
+	}
+	atom = ( document && ( !data || data->InternsNames() ) ) ? document->Intern( pErr, p - pErr ) : 0;
 	p = SkipWhiteSpace( p, encoding );
 	if ( !p || !*p || *p != '=' )
 	{
@@ -1426,7 +2220,16 @@ const char* TiXmlAttribute::Parse( const char* p, TiXmlParsingData* data, TiXmlE
 	const char SINGLE_QUOTE = '\'';
 	const char DOUBLE_QUOTE = '\"';
 
-	if ( *p == SINGLE_QUOTE )
+	inSituValue = 0;
+	if ( inSitu && ( *p == SINGLE_QUOTE || *p == DOUBLE_QUOTE ) )
+	{
+		char* start = const_cast< char* >( p+1 );
+		p = ReadTextInSitu( start, *p, encoding );
+		if ( !p )
+			return 0;
+		inSituValue = start;
+	}
+	else if ( *p == SINGLE_QUOTE )
 	{
 		++p;
 		end = "\'";		// single quote in string
@@ -1459,6 +2262,8 @@ const char* TiXmlAttribute::Parse( const char* p, TiXmlParsingData* data, TiXmlE
 			++p;
 		}
 	}
+	if ( nameEnd )
+		*nameEnd = 0;
 	return p;
 }
 
@@ -1499,7 +2304,7 @@ const char* TiXmlText::Parse( const char* p, TiXmlParsingData* data, TiXmlEncodi
 	value = "";
 	TiXmlDocument* document = GetDocument();
 
-	if ( data )
+	if ( data && data->TracksLocations() )
 	{
 		data->Stamp( p, encoding );
 		location = data->Cursor();
@@ -1580,7 +2385,7 @@ const char* TiXmlDeclaration::Parse( const char* p, TiXmlParsingData* data, TiXm
 		if ( document ) document->SetError( TIXML_ERROR_PARSING_DECLARATION, 0, 0, _encoding );
 		return 0;
 	}
-	if ( data )
+	if ( data && data->TracksLocations() )
 	{
 		data->Stamp( p, _encoding );
 		location = data->Cursor();